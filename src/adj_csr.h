@@ -0,0 +1,233 @@
+#ifndef _ADJ_CSR_H
+#define _ADJ_CSR_H
+
+#include <algorithm>
+#include <exception>
+#include <vector>
+
+#include "hierarchy.h"
+
+class csr_read_only
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "csr: hierarchy is read only";
+    }
+};
+
+/*
+ * Read only adjacency list in compressed sparse row form.
+ * Keys are mapped to dense ids by a sorted id table. The children of id i
+ * are the slice [offsets[i], offsets[i + 1]) of one contiguous array, and
+ * every id knows its parent and depth. Roots are their own parent.
+ * Preorder numbers make is_ancestor a constant time check: the descendants
+ * of id i are exactly the ids with preorder number in
+ * (preorder[i], preorder[i] + subtree size).
+ *
+ * A frozen hierarchy has a single version, so version arguments are
+ * ignored like in NestedIntervals.
+ */
+template <
+    class KeyType,
+    class ValueType
+>
+class AdjacencyCSR
+: public Hierarchy<KeyType, ValueType> {
+public:
+    using ValueTree = typename Hierarchy<KeyType, ValueType>::ValueTree;
+    using KeyVisitor = typename Hierarchy<KeyType, ValueType>::KeyVisitor;
+
+private:
+    std::vector<KeyType> ids;
+    std::vector<size_t> offsets;
+    std::vector<size_t> child_ids;
+    std::vector<size_t> parents;
+    std::vector<size_t> depths;
+    std::vector<size_t> preorder;
+    std::vector<size_t> subtree_sizes;
+
+    size_t position(KeyType const key) const {
+        size_t id;
+        if (!find(key, id)) {
+            throw hierarchy_key_not_found();
+        }
+        return id;
+    }
+
+    void build_index() {
+        size_t const num = ids.size();
+        parents.resize(num);
+        depths.assign(num, 0);
+        preorder.assign(num, 0);
+        subtree_sizes.assign(num, 1);
+        for (size_t id = 0; id < num; id++) {
+            parents[id] = id;
+        }
+        for (size_t id = 0; id < num; id++) {
+            for (size_t c = offsets[id]; c < offsets[id + 1]; c++) {
+                parents[child_ids[c]] = id;
+            }
+        }
+
+        // iterative preorder traversal from every root
+        std::vector<size_t> order;
+        order.reserve(num);
+        std::vector<size_t> dfs_stack;
+        for (size_t root = 0; root < num; root++) {
+            if (parents[root] != root) {
+                continue;
+            }
+            dfs_stack.push_back(root);
+            while (!dfs_stack.empty()) {
+                size_t id = dfs_stack.back();
+                dfs_stack.pop_back();
+                preorder[id] = order.size();
+                order.push_back(id);
+                for (size_t c = offsets[id + 1]; c-- > offsets[id];) {
+                    depths[child_ids[c]] = depths[id] + 1;
+                    dfs_stack.push_back(child_ids[c]);
+                }
+            }
+        }
+        // children come after their parents in preorder
+        for (size_t i = order.size(); i-- > 0;) {
+            size_t id = order[i];
+            if (parents[id] != id) {
+                subtree_sizes[parents[id]] += subtree_sizes[id];
+            }
+        }
+    }
+
+public:
+    AdjacencyCSR()
+    : Hierarchy<KeyType, ValueType>(), ids(), offsets(1, 0), child_ids() {
+    }
+
+    /*
+     * ids has to be sorted, the children of ids[i] are the dense ids
+     * child_ids[offsets[i]] to child_ids[offsets[i + 1] - 1].
+     */
+    AdjacencyCSR(
+        ValueTree values,
+        std::vector<KeyType> ids,
+        std::vector<size_t> offsets,
+        std::vector<size_t> child_ids
+    )
+    : Hierarchy<KeyType, ValueType>(values), ids(ids), offsets(offsets), child_ids(child_ids) {
+        build_index();
+    }
+
+    size_t size() const {
+        return ids.size();
+    }
+
+    /*
+     * Maps key to its dense id. Returns false if the key is unknown.
+     */
+    bool find(KeyType const key, size_t& id) const {
+        auto it = std::lower_bound(ids.begin(), ids.end(), key);
+        if (it == ids.end() || *it != key) {
+            return false;
+        }
+        id = it - ids.begin();
+        return true;
+    }
+
+    KeyType key(size_t const id) const {
+        return ids[id];
+    }
+
+    size_t parent(size_t const id) const {
+        return parents[id];
+    }
+
+    size_t depth(size_t const id) const {
+        return depths[id];
+    }
+
+    /*
+     * Dense ids of the children of id as a slice of the children array.
+     */
+    size_t const* children_begin(size_t const id) const {
+        return child_ids.data() + offsets[id];
+    }
+
+    size_t const* children_end(size_t const id) const {
+        return child_ids.data() + offsets[id + 1];
+    }
+
+    /*
+     * Calls f with the dense id of every descendant of id in preorder.
+     */
+    template <class Function>
+    void for_each_descendant(size_t const id, Function f) const {
+        std::vector<size_t> dfs_stack(children_begin(id), children_end(id));
+        std::reverse(dfs_stack.begin(), dfs_stack.end());
+        while (!dfs_stack.empty()) {
+            size_t next = dfs_stack.back();
+            dfs_stack.pop_back();
+            f(next);
+            for (size_t const* c = children_end(next); c-- != children_begin(next);) {
+                dfs_stack.push_back(*c);
+            }
+        }
+    }
+
+    virtual bool exists(KeyType const key, size_t const version) const {
+        size_t id;
+        return find(key, id);
+    }
+
+    virtual size_t num_childs(KeyType const key, size_t const version) const {
+        size_t id = position(key);
+        return offsets[id + 1] - offsets[id];
+    }
+
+    using Hierarchy<KeyType, ValueType>::for_each_child;
+
+    virtual void for_each_child(KeyType const key, size_t const version, KeyVisitor& visitor) const {
+        size_t id = position(key);
+        for (size_t const* c = children_begin(id); c != children_end(id); c++) {
+            visitor.visit(ids[*c]);
+        }
+    }
+
+    virtual bool is_ancestor(KeyType const parent, KeyType const child, size_t const version) const {
+        size_t p = position(parent);
+        size_t c = position(child);
+        return preorder[p] < preorder[c] && preorder[c] < preorder[p] + subtree_sizes[p];
+    }
+
+    virtual KeyType lca(KeyType const a, KeyType const b, size_t const version) const {
+        size_t id_a = position(a);
+        size_t id_b = position(b);
+        while (depths[id_a] > depths[id_b]) {
+            id_a = parents[id_a];
+        }
+        while (depths[id_b] > depths[id_a]) {
+            id_b = parents[id_b];
+        }
+        while (id_a != id_b) {
+            if (depths[id_a] == 0) {
+                throw hierarchy_no_common_ancestor();
+            }
+            id_a = parents[id_a];
+            id_b = parents[id_b];
+        }
+        return ids[id_a];
+    }
+
+    virtual void insert(KeyType const parent, KeyType const key, ValueType const value) {
+        throw csr_read_only();
+    }
+
+    virtual void remove(KeyType const key) {
+        throw csr_read_only();
+    }
+
+    virtual size_t commit() {
+        return 0;
+    }
+};
+
+#endif
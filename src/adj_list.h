@@ -1,12 +1,57 @@
 #ifndef _ADJ_LIST_H
 #define _ADJ_LIST_H
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <stack>
+#include <utility>
 #include <vector>
 
+#include "adj_csr.h"
 #include "bptree.h"
 #include "hierarchy.h"
+#include "thread_pool.h"
 
+class adj_invalid_version
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "adj: invalid version";
+    }
+};
+
+class adj_key_exists
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "adj: key already exists";
+    }
+};
+
+class adj_no_ancestor
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "adj: key has no ancestor at this distance";
+    }
+};
+
+class adj_key_has_children
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "adj: key has children";
+    }
+};
+
+/*
+ * Edges and nodes are stamped with the version that created them (begin)
+ * and the version that removed them (end, 0 while they are alive), so
+ * version v sees exactly the entries with begin <= v < end. Pending changes
+ * are stamped with the next version, commit publishes them by increasing
+ * the current version.
+ */
 template <
     class KeyType,
     class ValueType
@@ -17,71 +62,719 @@ public:
     struct AdjacentEdge {
         KeyType parent;
         KeyType child;
+        size_t begin;
+        size_t end;
+    };
+
+    /*
+     * Position of a key in the tree. Roots are their own parent.
+     * jump points to an ancestor such that following jump and parent
+     * pointers reaches any ancestor in O(log depth) steps (skew-binary
+     * jump pointers).
+     * A removed key can be inserted again, so a key may have several nodes
+     * with disjoint lifetimes.
+     */
+    struct AdjacentNode {
+        KeyType parent;
+        KeyType jump;
+        size_t depth;
+        size_t jump_depth;
+        size_t begin;
+        size_t end;
     };
 
     typedef BPTree<AdjacentEdge, KeyType> AdjacencyTree;
+    typedef BPTree<AdjacentNode, KeyType> NodeTree;
+    typedef AdjacencyCSR<KeyType, ValueType> FrozenList;
     using ValueTree = typename Hierarchy<KeyType, ValueType>::ValueTree;
+    using KeyVisitor = typename Hierarchy<KeyType, ValueType>::KeyVisitor;
+
+    /*
+     * Lazy range over the children of a key in one version. Iterating
+     * filters the edges of the key in place, nothing is copied.
+     */
+    class ChildRange {
+    private:
+        typedef typename AdjacencyTree::BPKeyValues EdgeValues;
+        typedef typename AdjacencyTree::BPKeyIterator EdgeIterator;
+
+        EdgeValues edge_values;
+        size_t version;
+
+    public:
+        class iterator {
+        private:
+            EdgeIterator it;
+            EdgeIterator end;
+            size_t version;
+
+            void skip_invisible() {
+                while (it != end && !visible((*it).begin, (*it).end, version)) {
+                    ++it;
+                }
+            }
+
+        public:
+            iterator(EdgeIterator const& it, EdgeIterator const& end, size_t const version)
+            : it(it), end(end), version(version) {
+                skip_invisible();
+            }
+
+            KeyType operator *() const {
+                return (*it).child;
+            }
+
+            iterator& operator ++() {
+                ++it;
+                skip_invisible();
+                return *this;
+            }
+
+            bool operator ==(iterator const& other) const {
+                return it == other.it;
+            }
+
+            bool operator !=(iterator const& other) const {
+                return it != other.it;
+            }
+        };
+
+        ChildRange(EdgeValues const& edge_values, size_t const version)
+        : edge_values(edge_values), version(version) {
+        }
+
+        iterator begin() const {
+            return iterator(edge_values.begin(), edge_values.end(), version);
+        }
+
+        iterator end() const {
+            return iterator(edge_values.end(), edge_values.end(), version);
+        }
+    };
 
 private:
     AdjacencyTree edges;
+    NodeTree nodes;
+    size_t num_edges;
+    size_t num_parents;
+    size_t current_version;
+    size_t oldest_version;
+    bool pending;
+    // number of newest versions kept by commit, 0 keeps all
+    size_t retained_versions;
+    // entries removed by each version since oldest_version
+    std::vector<size_t> removed;
 
-public:
-    AdjacencyList(ValueTree values, AdjacencyTree edges)
-    : Hierarchy<KeyType, ValueType>(values), edges(edges) {
+    static bool visible(size_t const begin, size_t const end, size_t const version) {
+        return begin <= version && (end == 0 || version < end);
     }
 
-    AdjacencyList()
-    : Hierarchy<KeyType, ValueType>(), edges() {
+    size_t pending_version() const {
+        return current_version + 1;
     }
 
-    virtual bool exists(KeyType const key, size_t const version) const {
-        return Hierarchy<KeyType, ValueType>::values.count_key(key) > 0;
+    void check_version(size_t const version) const {
+        if (version < oldest_version || version > current_version) {
+            throw adj_invalid_version();
+        }
     }
 
-    virtual size_t num_childs(KeyType const key, size_t const version) const {
-        if (Hierarchy<KeyType, ValueType>::values.count_key(key) == 0) {
-            throw hierarchy_key_not_found();
+    AdjacentNode make_child(KeyType const parent, AdjacentNode const& parent_node, size_t const version) const {
+        AdjacentNode node;
+        node.parent = parent;
+        node.depth = parent_node.depth + 1;
+        AdjacentNode jump_node = get_node(parent_node.jump, version);
+        if (parent_node.depth - parent_node.jump_depth == jump_node.depth - jump_node.jump_depth) {
+            node.jump = jump_node.jump;
+            node.jump_depth = jump_node.jump_depth;
+        } else {
+            node.jump = parent;
+            node.jump_depth = parent_node.depth;
+        }
+        node.begin = version;
+        node.end = 0;
+        return node;
+    }
+
+    /*
+     * Keys without any edge are roots of their own.
+     */
+    void build_nodes() {
+        BPTree<KeyType, KeyType> has_parent;
+        num_edges = 0;
+        num_parents = 0;
+        for (AdjacentEdge& edge : edges) {
+            edge.begin = 0;
+            edge.end = 0;
+            has_parent.insert(edge.child, edge.parent);
+            num_edges++;
+        }
+        std::stack<KeyType> dfs_stack;
+        bool first = true;
+        KeyType last;
+        for (AdjacentEdge& edge : edges) {
+            if (first || edge.parent != last) {
+                num_parents++;
+                if (has_parent.count_key(edge.parent) == 0) {
+                    nodes.insert(edge.parent, {edge.parent, edge.parent, 0, 0, 0, 0});
+                    dfs_stack.push(edge.parent);
+                }
+            }
+            first = false;
+            last = edge.parent;
+        }
+        while (!dfs_stack.empty()) {
+            KeyType key = dfs_stack.top();
+            dfs_stack.pop();
+            AdjacentNode node = get_node(key, 0);
+            for (AdjacentEdge& edge : edges.search_iter(key)) {
+                nodes.insert(edge.child, make_child(key, node, 0));
+                dfs_stack.push(edge.child);
+            }
+        }
+        ValueTree const& values = Hierarchy<KeyType, ValueType>::values;
+        for (auto it = values.begin(); it != values.end(); ++it) {
+            if (nodes.count_key(it.key()) == 0) {
+                nodes.insert(it.key(), {it.key(), it.key(), 0, 0, 0, 0});
+            }
+        }
+    }
+
+    AdjacentNode* find_node(KeyType const key, size_t const version) const {
+        for (AdjacentNode& node : nodes.search_iter(key)) {
+            if (visible(node.begin, node.end, version)) {
+                return &node;
+            }
         }
-        return edges.count_key(key);
+        return nullptr;
     }
 
-    virtual std::vector<KeyType> children(KeyType const key, size_t const version) const {
-        if (Hierarchy<KeyType, ValueType>::values.count_key(key) == 0) {
+    AdjacentNode get_node(KeyType const key, size_t const version) const {
+        AdjacentNode* node = find_node(key, version);
+        if (node == nullptr) {
             throw hierarchy_key_not_found();
         }
-        std::vector<KeyType> child_keys;
-        for (AdjacentEdge& edge : edges.search_iter(key)) {
-            child_keys.push_back(edge.child);
+        return *node;
+    }
+
+    KeyType ancestor_at_depth(KeyType key, AdjacentNode& node, size_t const depth, size_t const version) const {
+        while (node.depth > depth) {
+            if (node.jump_depth >= depth) {
+                key = node.jump;
+            } else {
+                key = node.parent;
+            }
+            node = get_node(key, version);
         }
-        return child_keys;
+        return key;
     }
 
-    virtual bool is_ancestor(KeyType const parent, KeyType const child, size_t const version) const {
-        std::stack<KeyType> dfs_stack;
-        dfs_stack.push(parent);
+    /*
+     * Searches child among the descendants of parent that are exactly
+     * distance levels below it.
+     */
+    bool find_below(KeyType const parent, KeyType const child, size_t const distance, size_t const version) const {
+        std::stack<std::pair<KeyType, size_t>> dfs_stack;
+        dfs_stack.push({parent, 0});
         while (!dfs_stack.empty()) {
-            KeyType key = dfs_stack.top();
+            std::pair<KeyType, size_t> top = dfs_stack.top();
             dfs_stack.pop();
-            for (AdjacentEdge& edge : edges.search_iter(key)) {
-                if (edge.child == child) {
-                    return true;
+            for (AdjacentEdge& edge : edges.search_iter(top.first)) {
+                if (!visible(edge.begin, edge.end, version)) {
+                    continue;
+                }
+                if (top.second + 1 == distance) {
+                    if (edge.child == child) {
+                        return true;
+                    }
+                } else {
+                    dfs_stack.push({edge.child, top.second + 1});
                 }
-                dfs_stack.push(edge.child);
             }
         }
         return false;
     }
 
+    size_t num_childs_at(KeyType const key, size_t const version) const {
+        get_node(key, version);
+        size_t num = 0;
+        for (AdjacentEdge& edge : edges.search_iter(key)) {
+            num += visible(edge.begin, edge.end, version);
+        }
+        return num;
+    }
+
+    void for_each_child_at(KeyType const key, size_t const version, KeyVisitor& visitor) const {
+        get_node(key, version);
+        for (AdjacentEdge& edge : edges.search_iter(key)) {
+            if (visible(edge.begin, edge.end, version)) {
+                visitor.visit(edge.child);
+            }
+        }
+    }
+
+    /*
+     * Walks upward from child to the depth of parent along the parent index,
+     * which takes O(log depth) steps with the jump pointers.
+     */
+    bool is_ancestor_at(KeyType const parent, KeyType const child, size_t const version) const {
+        AdjacentNode parent_node = get_node(parent, version);
+        AdjacentNode child_node = get_node(child, version);
+        if (child_node.depth <= parent_node.depth) {
+            return false;
+        }
+        return ancestor_at_depth(child, child_node, parent_node.depth, version) == parent;
+    }
+
+    /*
+     * Lifts the deeper key to the depth of the other one, then lifts both
+     * in lockstep. Nodes of equal depth have jump pointers of equal depth,
+     * so both take the jump unless it would skip the common ancestor.
+     */
+    KeyType lca_at(KeyType const a, KeyType const b, size_t const version) const {
+        AdjacentNode node_a = get_node(a, version);
+        AdjacentNode node_b = get_node(b, version);
+        size_t depth = std::min(node_a.depth, node_b.depth);
+        KeyType key_a = ancestor_at_depth(a, node_a, depth, version);
+        KeyType key_b = ancestor_at_depth(b, node_b, depth, version);
+        while (key_a != key_b) {
+            if (node_a.depth == 0) {
+                throw hierarchy_no_common_ancestor();
+            }
+            if (node_a.jump != node_b.jump) {
+                key_a = node_a.jump;
+                key_b = node_b.jump;
+            } else {
+                key_a = node_a.parent;
+                key_b = node_b.parent;
+            }
+            node_a = get_node(key_a, version);
+            node_b = get_node(key_b, version);
+        }
+        return key_a;
+    }
+
+    /*
+     * Like is_ancestor_at, but searches downward from parent instead if that
+     * is expected to be cheaper. Going up takes about two jumps per halving
+     * of the distance, the edges visited going down are estimated from the
+     * fanout of parent and the average fanout of the tree.
+     */
+    bool is_ancestor_bidirectional_at(KeyType const parent, KeyType const child, size_t const version) const {
+        AdjacentNode parent_node = get_node(parent, version);
+        AdjacentNode child_node = get_node(child, version);
+        if (child_node.depth <= parent_node.depth) {
+            return false;
+        }
+        size_t const distance = child_node.depth - parent_node.depth;
+        double up_cost = 1;
+        for (size_t d = distance; d > 1; d /= 2) {
+            up_cost += 2;
+        }
+        double const fanout = num_parents == 0 ? 0.0 : double(num_edges) / num_parents;
+        // stop counting the children early, only cheap searches matter
+        double width = 0;
+        for (AdjacentEdge& edge : edges.search_iter(parent)) {
+            if (visible(edge.begin, edge.end, version) && ++width >= up_cost) {
+                break;
+            }
+        }
+        double down_cost = width;
+        for (size_t level = 1; level < distance && down_cost < up_cost; level++) {
+            width *= fanout;
+            down_cost += width;
+        }
+        if (down_cost < up_cost) {
+            return find_below(parent, child, distance, version);
+        }
+        return ancestor_at_depth(child, child_node, parent_node.depth, version) == parent;
+    }
+
+    /*
+     * Level synchronous breadth first search below key, at most max_depth
+     * levels deep. Every level is cut into chunks that the workers of pool
+     * take in parallel, and each worker collects the next level in its own
+     * buffer. visit(child, worker) is called once per descendant and
+     * returns false to stop the whole search.
+     * Every key has a single visible parent, so no key is reached twice
+     * and no visited set is needed.
+     */
+    template <class Function>
+    void traverse(
+        KeyType const key,
+        size_t const version,
+        size_t const max_depth,
+        ThreadPool& pool,
+        Function visit
+    ) const {
+        get_node(key, version);
+        size_t const chunk = 64;
+        std::vector<KeyType> frontier(1, key);
+        std::vector<std::vector<KeyType>> next(pool.size());
+        std::atomic<bool> stop(false);
+        for (size_t depth = 0; depth < max_depth && !frontier.empty() && !stop; depth++) {
+            pool.parallel_for((frontier.size() + chunk - 1) / chunk, [&](size_t i, size_t worker) {
+                size_t const end = std::min(frontier.size(), (i + 1) * chunk);
+                for (size_t f = i * chunk; f < end && !stop; f++) {
+                    for (AdjacentEdge& edge : edges.search_iter(frontier[f])) {
+                        if (!visible(edge.begin, edge.end, version)) {
+                            continue;
+                        }
+                        if (!visit(edge.child, worker)) {
+                            stop = true;
+                            break;
+                        }
+                        next[worker].push_back(edge.child);
+                    }
+                }
+            });
+            frontier.clear();
+            for (std::vector<KeyType>& buffer : next) {
+                frontier.insert(frontier.end(), buffer.begin(), buffer.end());
+                buffer.clear();
+            }
+        }
+    }
+
+    KeyType kth_ancestor_at(KeyType const key, size_t const k, size_t const version) const {
+        AdjacentNode node = get_node(key, version);
+        if (k > node.depth) {
+            throw adj_no_ancestor();
+        }
+        return ancestor_at_depth(key, node, node.depth - k, version);
+    }
+
+    void count_removed(size_t const version) {
+        if (removed.size() <= version - oldest_version) {
+            removed.resize(version - oldest_version + 1, 0);
+        }
+        removed[version - oldest_version]++;
+    }
+
+public:
+    AdjacencyList(ValueTree values, AdjacencyTree edges, size_t const retained_versions = 0)
+    : Hierarchy<KeyType, ValueType>(values), edges(edges), nodes(), num_edges(0), num_parents(0),
+      current_version(0), oldest_version(0), pending(false), retained_versions(retained_versions), removed() {
+        build_nodes();
+    }
+
+    AdjacencyList()
+    : Hierarchy<KeyType, ValueType>(), edges(), nodes(), num_edges(0), num_parents(0),
+      current_version(0), oldest_version(0), pending(false), retained_versions(0), removed() {
+    }
+
+    size_t max_version() const {
+        return current_version;
+    }
+
+    size_t min_version() const {
+        return oldest_version;
+    }
+
+    /*
+     * Drops all edges, nodes and values that are not visible in any version
+     * from watermark on. Older versions can't be queried afterwards.
+     * Returns the number of dropped edges and nodes.
+     */
+    size_t collect_garbage(size_t watermark) {
+        watermark = std::min(watermark, current_version);
+        if (watermark <= oldest_version) {
+            return 0;
+        }
+        size_t dropped = 0;
+        AdjacencyTree new_edges;
+        for (AdjacentEdge& edge : edges) {
+            if (edge.end != 0 && edge.end <= watermark) {
+                dropped++;
+            } else {
+                new_edges.insert(edge.parent, edge);
+            }
+        }
+        NodeTree new_nodes;
+        for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+            if ((*it).end != 0 && (*it).end <= watermark) {
+                dropped++;
+            } else {
+                new_nodes.insert(it.key(), *it);
+            }
+        }
+        ValueTree new_values;
+        ValueTree& values = Hierarchy<KeyType, ValueType>::values;
+        for (auto it = values.begin(); it != values.end(); ++it) {
+            if (new_nodes.count_key(it.key()) > 0) {
+                new_values.insert(it.key(), *it);
+            }
+        }
+        edges = new_edges;
+        nodes = new_nodes;
+        values = new_values;
+
+        size_t const collected = std::min(removed.size(), watermark - oldest_version + 1);
+        removed.erase(removed.begin(), removed.begin() + collected);
+        removed.insert(removed.begin(), 0);
+        oldest_version = watermark;
+        return dropped;
+    }
+
+    /*
+     * Copies the given committed version into a read only CSR hierarchy.
+     */
+    FrozenList freeze(size_t const version) const {
+        check_version(version);
+        std::vector<KeyType> ids;
+        for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+            if (visible((*it).begin, (*it).end, version) && (ids.empty() || ids.back() != it.key())) {
+                ids.push_back(it.key());
+            }
+        }
+        std::vector<size_t> offsets(1, 0);
+        std::vector<size_t> child_ids;
+        for (KeyType const key : ids) {
+            for (KeyType const child : ChildRange(edges.search_iter(key), version)) {
+                child_ids.push_back(std::lower_bound(ids.begin(), ids.end(), child) - ids.begin());
+            }
+            offsets.push_back(child_ids.size());
+        }
+        return FrozenList(Hierarchy<KeyType, ValueType>::values, ids, offsets, child_ids);
+    }
+
+    FrozenList freeze() const {
+        return freeze(current_version);
+    }
+
+    virtual bool exists(KeyType const key) const {
+        return find_node(key, pending_version()) != nullptr;
+    }
+
+    virtual bool exists(KeyType const key, size_t const version) const {
+        check_version(version);
+        return find_node(key, version) != nullptr;
+    }
+
+    virtual size_t num_childs(KeyType const key) const {
+        return num_childs_at(key, pending_version());
+    }
+
+    virtual size_t num_childs(KeyType const key, size_t const version) const {
+        check_version(version);
+        return num_childs_at(key, version);
+    }
+
+    virtual void for_each_child(KeyType const key, KeyVisitor& visitor) const {
+        for_each_child_at(key, pending_version(), visitor);
+    }
+
+    virtual void for_each_child(KeyType const key, size_t const version, KeyVisitor& visitor) const {
+        check_version(version);
+        for_each_child_at(key, version, visitor);
+    }
+
+    ChildRange child_range(KeyType const key) const {
+        get_node(key, pending_version());
+        return ChildRange(edges.search_iter(key), pending_version());
+    }
+
+    ChildRange child_range(KeyType const key, size_t const version) const {
+        check_version(version);
+        get_node(key, version);
+        return ChildRange(edges.search_iter(key), version);
+    }
+
+    virtual bool is_ancestor(KeyType const parent, KeyType const child) const {
+        return is_ancestor_at(parent, child, pending_version());
+    }
+
+    virtual bool is_ancestor(KeyType const parent, KeyType const child, size_t const version) const {
+        check_version(version);
+        return is_ancestor_at(parent, child, version);
+    }
+
+    /*
+     * Variant of is_ancestor that may search downward from parent instead.
+     */
+    bool is_ancestor_bidirectional(KeyType const parent, KeyType const child) const {
+        return is_ancestor_bidirectional_at(parent, child, pending_version());
+    }
+
+    bool is_ancestor_bidirectional(KeyType const parent, KeyType const child, size_t const version) const {
+        check_version(version);
+        return is_ancestor_bidirectional_at(parent, child, version);
+    }
+
+    /*
+     * Number of ancestors of key. Roots have depth 0.
+     */
+    size_t depth(KeyType const key) const {
+        return get_node(key, pending_version()).depth;
+    }
+
+    size_t depth(KeyType const key, size_t const version) const {
+        check_version(version);
+        return get_node(key, version).depth;
+    }
+
+    /*
+     * Returns the ancestor k levels above key, key itself for k = 0.
+     * Follows the jump pointers, so this takes O(log depth) steps.
+     */
+    KeyType kth_ancestor(KeyType const key, size_t const k) const {
+        return kth_ancestor_at(key, k, pending_version());
+    }
+
+    KeyType kth_ancestor(KeyType const key, size_t const k, size_t const version) const {
+        check_version(version);
+        return kth_ancestor_at(key, k, version);
+    }
+
+    /*
+     * All descendants of key in the given version, in no particular order.
+     */
+    std::vector<KeyType> descendants(KeyType const key, size_t const version, ThreadPool& pool) const {
+        check_version(version);
+        std::vector<std::vector<KeyType>> found(pool.size());
+        traverse(key, version, SIZE_MAX, pool, [&found](KeyType const child, size_t const worker) {
+            found[worker].push_back(child);
+            return true;
+        });
+        std::vector<KeyType> result;
+        for (std::vector<KeyType>& keys : found) {
+            result.insert(result.end(), keys.begin(), keys.end());
+        }
+        return result;
+    }
+
+    size_t num_descendants(KeyType const key, size_t const version, ThreadPool& pool) const {
+        check_version(version);
+        // one cache line per worker
+        size_t const stride = 64 / sizeof(size_t);
+        std::vector<size_t> counts(pool.size() * stride, 0);
+        traverse(key, version, SIZE_MAX, pool, [&counts, stride](KeyType const, size_t const worker) {
+            counts[worker * stride]++;
+            return true;
+        });
+        size_t num = 0;
+        for (size_t worker = 0; worker < pool.size(); worker++) {
+            num += counts[worker * stride];
+        }
+        return num;
+    }
+
+    /*
+     * Searches child below parent in parallel. The search ends at the depth
+     * of child or as soon as child is found.
+     */
+    bool is_ancestor(KeyType const parent, KeyType const child, size_t const version, ThreadPool& pool) const {
+        check_version(version);
+        AdjacentNode parent_node = get_node(parent, version);
+        AdjacentNode child_node = get_node(child, version);
+        if (child_node.depth <= parent_node.depth) {
+            return false;
+        }
+        std::atomic<bool> found(false);
+        traverse(parent, version, child_node.depth - parent_node.depth, pool,
+            [&found, child](KeyType const key, size_t) {
+                if (key == child) {
+                    found = true;
+                    return false;
+                }
+                return true;
+            }
+        );
+        return found;
+    }
+
+    virtual KeyType lca(KeyType const a, KeyType const b) const {
+        return lca_at(a, b, pending_version());
+    }
+
+    virtual KeyType lca(KeyType const a, KeyType const b, size_t const version) const {
+        check_version(version);
+        return lca_at(a, b, version);
+    }
+
+    /*
+     * Adds key as a child of parent. Like remove, the change is only
+     * seen by queries without a version until it is committed.
+     * Values are not versioned, inserting a removed key again overwrites
+     * its value.
+     */
     virtual void insert(KeyType const parent, KeyType const key, ValueType const value) {
-        return;
+        size_t const version = pending_version();
+        AdjacentNode parent_node = get_node(parent, version);
+        if (find_node(key, version) != nullptr) {
+            throw adj_key_exists();
+        }
+        if (num_childs_at(parent, version) == 0) {
+            num_parents++;
+        }
+        num_edges++;
+        edges.insert(parent, {parent, key, version, 0});
+        nodes.insert(key, make_child(parent, parent_node, version));
+
+        bool found = false;
+        for (ValueType& v : Hierarchy<KeyType, ValueType>::values.search_iter(key)) {
+            v = value;
+            found = true;
+        }
+        if (!found) {
+            Hierarchy<KeyType, ValueType>::values.insert(key, value);
+        }
+        pending = true;
     }
 
+    /*
+     * Removes a key without children.
+     */
     virtual void remove(KeyType const key) {
-        return;
+        size_t const version = pending_version();
+        AdjacentNode* node = find_node(key, version);
+        if (node == nullptr) {
+            throw hierarchy_key_not_found();
+        }
+        if (num_childs_at(key, version) > 0) {
+            throw adj_key_has_children();
+        }
+        node->end = version;
+        count_removed(version);
+        if (node->depth > 0) {
+            for (AdjacentEdge& edge : edges.search_iter(node->parent)) {
+                if (edge.child == key && visible(edge.begin, edge.end, version)) {
+                    edge.end = version;
+                    count_removed(version);
+                    break;
+                }
+            }
+            num_edges--;
+            if (num_childs_at(node->parent, version) == 0) {
+                num_parents--;
+            }
+        }
+        pending = true;
     }
 
+    /*
+     * Publishes all pending changes as a new version and returns it.
+     * If only some versions are retained, the older ones are collected once
+     * their removed entries make up a quarter of the edges, so the cost of
+     * rebuilding the trees is amortized over the removals.
+     */
     virtual size_t commit() {
-        return 0;
+        if (!pending) {
+            return current_version;
+        }
+        current_version++;
+        pending = false;
+        if (retained_versions > 0 && current_version - oldest_version > retained_versions) {
+            size_t const watermark = current_version - retained_versions;
+            size_t garbage = 0;
+            for (size_t v = oldest_version; v <= watermark && v - oldest_version < removed.size(); v++) {
+                garbage += removed[v - oldest_version];
+            }
+            if (garbage > 0 && garbage * 4 >= num_edges) {
+                collect_garbage(watermark);
+            }
+        }
+        return current_version;
     }
 };
 
@@ -467,6 +467,10 @@ public:
             return *node->leaf.values[index];
         }
 
+        KeyType key() const {
+            return node->keys[index];
+        }
+
         BPRangeIterator& operator ++() {
             if (node != nullptr) {
                 index++;
@@ -588,6 +592,9 @@ public:
     }
 
     BPRangeIterator begin() const {
+        if (root_node->num_keys == 0) {
+            return end();
+        }
         BPNode* node = root_node;
         while (node->type == BP_INNER) {
             node = node->inner.pointers[0];
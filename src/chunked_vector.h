@@ -0,0 +1,135 @@
+#ifndef _CHUNKED_VECTOR_H
+#define _CHUNKED_VECTOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/*
+ * Append only vector for one writer and any number of readers.
+ * Elements are stored in chunks that double in size, a chunk is never
+ * moved or freed while the vector lives, so references stay valid.
+ * push_back publishes the new size with a release store: a reader that
+ * sees the size also sees every element before it, without any lock.
+ * Copying, assigning and clear have to be done without concurrent readers.
+ */
+template <class T>
+class ChunkedVector {
+private:
+    static size_t const FIRST_CHUNK = 16;
+    static size_t const MAX_CHUNKS = sizeof(size_t) * 8 - 4;
+
+    std::atomic<T*> chunks[MAX_CHUNKS];
+    std::atomic<size_t> num;
+
+    /*
+     * Chunk c holds FIRST_CHUNK << c elements and starts at element
+     * FIRST_CHUNK * (2^c - 1).
+     */
+    static size_t chunk_of(size_t const i) {
+        size_t n = i / FIRST_CHUNK + 1;
+        size_t chunk = 0;
+        while (n >>= 1) {
+            chunk++;
+        }
+        return chunk;
+    }
+
+    static size_t chunk_start(size_t const chunk) {
+        return FIRST_CHUNK * ((static_cast<size_t>(1) << chunk) - 1);
+    }
+
+    void free_chunks() {
+        for (size_t c = 0; c < MAX_CHUNKS; c++) {
+            delete[] chunks[c].load(std::memory_order_relaxed);
+            chunks[c].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    ChunkedVector()
+    : num(0) {
+        for (size_t c = 0; c < MAX_CHUNKS; c++) {
+            chunks[c].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ChunkedVector(ChunkedVector const& other)
+    : ChunkedVector() {
+        for (size_t i = 0; i < other.size(); i++) {
+            push_back(other[i]);
+        }
+    }
+
+    ChunkedVector(ChunkedVector&& other)
+    : ChunkedVector() {
+        swap(other);
+    }
+
+    ~ChunkedVector() {
+        free_chunks();
+    }
+
+    ChunkedVector& operator =(ChunkedVector other) {
+        swap(other);
+        return *this;
+    }
+
+    void swap(ChunkedVector& other) {
+        for (size_t c = 0; c < MAX_CHUNKS; c++) {
+            T* chunk = chunks[c].load(std::memory_order_relaxed);
+            chunks[c].store(other.chunks[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            other.chunks[c].store(chunk, std::memory_order_relaxed);
+        }
+        size_t size = num.load(std::memory_order_relaxed);
+        num.store(other.num.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        other.num.store(size, std::memory_order_relaxed);
+    }
+
+    size_t size() const {
+        return num.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /*
+     * Number of elements the allocated chunks hold.
+     */
+    size_t capacity() const {
+        size_t num_chunks = empty() ? 0 : chunk_of(size() - 1) + 1;
+        return chunk_start(num_chunks);
+    }
+
+    /*
+     * i has to be less than a size this thread has seen.
+     */
+    T const& operator [](size_t const i) const {
+        size_t chunk = chunk_of(i);
+        return chunks[chunk].load(std::memory_order_relaxed)[i - chunk_start(chunk)];
+    }
+
+    T const& back() const {
+        return (*this)[size() - 1];
+    }
+
+    void push_back(T const& value) {
+        size_t i = num.load(std::memory_order_relaxed);
+        size_t chunk = chunk_of(i);
+        T* data = chunks[chunk].load(std::memory_order_relaxed);
+        if (data == nullptr) {
+            data = new T[FIRST_CHUNK << chunk];
+            chunks[chunk].store(data, std::memory_order_relaxed);
+        }
+        data[i - chunk_start(chunk)] = value;
+        num.store(i + 1, std::memory_order_release);
+    }
+
+    void clear() {
+        free_chunks();
+        num.store(0, std::memory_order_relaxed);
+    }
+};
+
+#endif
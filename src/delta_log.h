@@ -0,0 +1,208 @@
+#ifndef _DELTA_LOG_H
+#define _DELTA_LOG_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hierarchy.h"
+
+class delta_log_io_error
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "delta log: io error";
+    }
+};
+
+class delta_log_corrupt
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "delta log: log doesn't match the loaded hierarchy";
+    }
+};
+
+/*
+ * Append only file of binary records. Every record is framed by its
+ * length and a checksum, a record torn by a crash fails the check and it
+ * and everything behind it is cut off when the log is opened again.
+ * Records are written right away but only synced to disk once per group
+ * of group_size records, or on sync.
+ */
+class DeltaLog {
+private:
+    static uint64_t const MAGIC = UINT64_C(0x31474f4c41544448);
+    static size_t const HEADER = 2 * sizeof(uint64_t);
+
+    int fd;
+    size_t group_size;
+    size_t unsynced;
+
+    static uint64_t checksum(char const* data, size_t const size) {
+        // FNV-1a
+        uint64_t hash = UINT64_C(0xcbf29ce484222325);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * UINT64_C(0x100000001b3);
+        }
+        return hash;
+    }
+
+    static uint64_t read_u64(char const* data) {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    /*
+     * Calls f(data, size) for every intact record of the size bytes at
+     * log. Returns the offset behind the last intact record.
+     */
+    template <class Function>
+    static size_t scan(char const* log, size_t const size, Function f) {
+        if (size < sizeof(MAGIC) || read_u64(log) != MAGIC) {
+            throw delta_log_corrupt();
+        }
+        size_t pos = sizeof(MAGIC);
+        while (size - pos >= HEADER) {
+            uint64_t length = read_u64(log + pos);
+            if (length > size - pos - HEADER) {
+                break;
+            }
+            char const* record = log + pos + HEADER;
+            if (read_u64(log + pos + sizeof(uint64_t)) != checksum(record, length)) {
+                break;
+            }
+            f(record, length);
+            pos += HEADER + length;
+        }
+        return pos;
+    }
+
+    /*
+     * Maps the file fd and scans it like scan. An empty file has no
+     * records.
+     */
+    template <class Function>
+    static size_t scan_file(int const fd, Function f) {
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            throw delta_log_io_error();
+        }
+        size_t const size = info.st_size;
+        if (size == 0) {
+            return 0;
+        }
+        void* log = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (log == MAP_FAILED) {
+            throw delta_log_io_error();
+        }
+        size_t end;
+        try {
+            end = scan(static_cast<char const*>(log), size, f);
+        } catch (...) {
+            munmap(log, size);
+            throw;
+        }
+        munmap(log, size);
+        return end;
+    }
+
+    void write_all(char const* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = write(fd, data, size);
+            if (written < 0) {
+                throw delta_log_io_error();
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+public:
+    /*
+     * Opens or creates the log at path for appending.
+     */
+    DeltaLog(std::string const& path, size_t const group_size = 1)
+    : fd(-1), group_size(group_size), unsynced(0) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw delta_log_io_error();
+        }
+        try {
+            size_t end = scan_file(fd, [](char const*, size_t) {});
+            if (end == 0) {
+                uint64_t magic = MAGIC;
+                write_all(reinterpret_cast<char const*>(&magic), sizeof(magic));
+                end = sizeof(magic);
+            }
+            if (ftruncate(fd, end) != 0 || lseek(fd, end, SEEK_SET) < 0) {
+                throw delta_log_io_error();
+            }
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    DeltaLog(DeltaLog const&) = delete;
+    DeltaLog& operator =(DeltaLog const&) = delete;
+
+    ~DeltaLog() {
+        if (unsynced > 0) {
+            fdatasync(fd);
+        }
+        close(fd);
+    }
+
+    void append(std::string const& record) {
+        uint64_t header[2] = {record.size(), checksum(record.data(), record.size())};
+        std::string framed(reinterpret_cast<char const*>(header), HEADER);
+        framed += record;
+        write_all(framed.data(), framed.size());
+        if (++unsynced >= group_size) {
+            sync();
+        }
+    }
+
+    /*
+     * Makes every appended record durable.
+     */
+    void sync() {
+        if (fdatasync(fd) != 0) {
+            throw delta_log_io_error();
+        }
+        unsynced = 0;
+    }
+
+    /*
+     * Calls f(data, size) for every intact record of the log at path and
+     * returns the number of records. A missing log has none.
+     */
+    template <class Function>
+    static size_t replay(std::string const& path, Function f) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return 0;
+        }
+        size_t num = 0;
+        try {
+            scan_file(fd, [&num, &f](char const* data, size_t const size) {
+                f(data, size);
+                num++;
+            });
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+        return num;
+    }
+};
+
+#endif
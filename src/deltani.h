@@ -1,11 +1,26 @@
 #ifndef _DELTANI_H
 #define _DELTANI_H
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "bptree.h"
+#include "chunked_vector.h"
+#include "delta_log.h"
 #include "nested_intervals.h"
+#include "thread_pool.h"
 
 class deltani_invalid_version
 : public hierarchy_error {
@@ -47,6 +62,30 @@ public:
     }
 };
 
+class deltani_invalid_move
+: public deltani_invalid_key {
+public:
+    virtual const char* what() const noexcept {
+        return "deltani: can't move a key below itself";
+    }
+};
+
+class deltani_bounds_exhausted
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "deltani: no interval bounds left for new keys, compact first";
+    }
+};
+
+class deltani_compact_error
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "deltani: can't compact with uncommitted changes or an attached log";
+    }
+};
+
 template <
     class KeyType,
     class ValueType
@@ -56,6 +95,9 @@ class DeltaNI
 public:
     using NIEdge = typename NestedIntervals<KeyType, ValueType>::NIEdge;
     using NIEdgeTree = typename NestedIntervals<KeyType, ValueType>::NIEdgeTree;
+    using NISortedEdgeTree = typename NestedIntervals<KeyType, ValueType>::NISortedEdgeTree;
+    using NIEdgeColumns = typename NestedIntervals<KeyType, ValueType>::NIEdgeColumns;
+    using KeyVisitor = typename Hierarchy<KeyType, ValueType>::KeyVisitor;
     using ValueTree = typename Hierarchy<KeyType, ValueType>::ValueTree;
 
     struct DeltaRange {
@@ -63,153 +105,1057 @@ public:
         uint64_t to;
     };
 
-    typedef BPTree<DeltaRange, KeyType> DeltaRangeTree;
-
+    /*
+     * Piecewise shift of the label space. Every range maps the labels from
+     * its from up to the next from by the same offset to. Ranges are kept
+     * as flat sorted arrays, once for evaluate and once for evaluate_inv,
+     * with the offset of every range next to its bound. The four arrays
+     * share one allocation and an empty function allocates nothing. If
+     * every bound fits into 32 bits and every offset into 31, the arrays
+     * are narrow and store 32 bit entries, offsets as signed differences.
+     */
     class DeltaFunction {
     private:
-        DeltaRangeTree ranges;
-        DeltaRangeTree ranges_inv;
+        enum Column {FROMS, SHIFTS, TOS, INV_SHIFTS};
+
+        void* block;
+        size_t num;
+        bool narrow;
+
+        template <class T>
+        T* column(Column const c) const {
+            return static_cast<T*>(block) + c * num;
+        }
+
+        uint64_t entry(Column const c, size_t const i) const {
+            if (narrow) {
+                return column<uint32_t>(c)[i];
+            } else {
+                return column<uint64_t>(c)[i];
+            }
+        }
+
+        /*
+         * Offsets wrap around, narrow ones are sign extended.
+         */
+        uint64_t shift(Column const c, size_t const i) const {
+            if (narrow) {
+                return static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(column<uint32_t>(c)[i])));
+            } else {
+                return column<uint64_t>(c)[i];
+            }
+        }
+
+        /*
+         * Index of the last bound not greater than value or 0 if there is
+         * none. The loop has a fixed trip count for a given size and the
+         * compiler turns the select into a conditional move.
+         */
+        template <class T>
+        static size_t predecessor(T const* const bounds, size_t num, uint64_t const value) {
+            T const* base = bounds;
+            while (num > 1) {
+                size_t half = num / 2;
+                base = base[half] <= value ? base + half : base;
+                num -= half;
+            }
+            return base - bounds;
+        }
+
+        /*
+         * Shifts value by the offset of its range. Narrow offsets are read
+         * as Shift = int32_t, which sign extends them.
+         */
+        template <class T, class Shift>
+        uint64_t lookup(Column const bounds, Column const shifts, uint64_t const value) const {
+            T const* offsets = column<T>(shifts);
+            return value + static_cast<uint64_t>(static_cast<Shift>(offsets[predecessor(column<T>(bounds), num, value)]));
+        }
+
+        /*
+         * Shifts both bounds of an edge with one interleaved search, the
+         * two chains of dependent loads overlap.
+         */
+        template <class T, class Shift>
+        void lookup_edge(NIBound& lower, NIBound& upper) const {
+            T const* const bounds = column<T>(FROMS);
+            T const* const offsets = column<T>(SHIFTS);
+            T const* base_lower = bounds;
+            T const* base_upper = bounds;
+            size_t n = num;
+            while (n > 1) {
+                size_t half = n / 2;
+                base_lower = base_lower[half] <= lower ? base_lower + half : base_lower;
+                base_upper = base_upper[half] <= upper ? base_upper + half : base_upper;
+                n -= half;
+            }
+            lower += static_cast<NIBound>(static_cast<Shift>(offsets[base_lower - bounds]));
+            upper += static_cast<NIBound>(static_cast<Shift>(offsets[base_upper - bounds]));
+        }
+
+        uint64_t lookup(Column const bounds, Column const shifts, uint64_t const value) const {
+            if (narrow) {
+                return lookup<uint32_t, int32_t>(bounds, shifts, value);
+            } else {
+                return lookup<uint64_t, uint64_t>(bounds, shifts, value);
+            }
+        }
+
+        size_t predecessor(Column const c, uint64_t const value) const {
+            if (narrow) {
+                return predecessor(column<uint32_t>(c), num, value);
+            } else {
+                return predecessor(column<uint64_t>(c), num, value);
+            }
+        }
+
+        template <class T>
+        void fill(std::vector<DeltaRange>& ranges) {
+            std::sort(ranges.begin(), ranges.end(), [](DeltaRange const& a, DeltaRange const& b) {
+                return a.from < b.from;
+            });
+            for (size_t i = 0; i < num; i++) {
+                column<T>(FROMS)[i] = static_cast<T>(ranges[i].from);
+                column<T>(SHIFTS)[i] = static_cast<T>(ranges[i].to - ranges[i].from);
+            }
+            std::sort(ranges.begin(), ranges.end(), [](DeltaRange const& a, DeltaRange const& b) {
+                return a.to < b.to;
+            });
+            for (size_t i = 0; i < num; i++) {
+                column<T>(TOS)[i] = static_cast<T>(ranges[i].to);
+                column<T>(INV_SHIFTS)[i] = static_cast<T>(ranges[i].from - ranges[i].to);
+            }
+        }
+
+        void release() {
+            ::operator delete(block);
+            block = nullptr;
+            num = 0;
+            narrow = false;
+        }
+
+        /*
+         * Builds the arrays at once from unsorted ranges.
+         */
+        DeltaFunction(std::vector<DeltaRange>& ranges, uint64_t const max)
+        : block(nullptr), num(ranges.size()), narrow(true), max(max) {
+            if (ranges.empty()) {
+                narrow = false;
+                return;
+            }
+            for (DeltaRange const& range : ranges) {
+                int64_t offset = static_cast<int64_t>(range.to - range.from);
+                if (range.from > UINT32_MAX || range.to > UINT32_MAX || offset > INT32_MAX || offset < -INT32_MAX) {
+                    narrow = false;
+                    break;
+                }
+            }
+            block = ::operator new(memory_usage());
+            if (narrow) {
+                fill<uint32_t>(ranges);
+            } else {
+                fill<uint64_t>(ranges);
+            }
+        }
 
     public:
         uint64_t max;
 
         DeltaFunction()
-        :ranges(), ranges_inv(), max(0) {
+        : block(nullptr), num(0), narrow(false), max(0) {
+        }
+
+        DeltaFunction(DeltaFunction const& other)
+        : block(nullptr), num(other.num), narrow(other.narrow), max(other.max) {
+            if (other.block != nullptr) {
+                block = ::operator new(other.memory_usage());
+                std::memcpy(block, other.block, other.memory_usage());
+            }
+        }
+
+        DeltaFunction(DeltaFunction&& other) noexcept
+        : block(other.block), num(other.num), narrow(other.narrow), max(other.max) {
+            other.block = nullptr;
+            other.num = 0;
+            other.narrow = false;
+        }
+
+        ~DeltaFunction() {
+            ::operator delete(block);
+        }
+
+        DeltaFunction& operator =(DeltaFunction const& other) {
+            if (this != &other) {
+                *this = DeltaFunction(other);
+            }
+            return *this;
+        }
+
+        DeltaFunction& operator =(DeltaFunction&& other) noexcept {
+            if (this != &other) {
+                release();
+                std::swap(block, other.block);
+                std::swap(num, other.num);
+                std::swap(narrow, other.narrow);
+                max = other.max;
+            }
+            return *this;
+        }
+
+        static DeltaFunction from_ranges(std::vector<DeltaRange> ranges, uint64_t const max) {
+            return DeltaFunction(ranges, max);
         }
 
         bool empty() const {
-            return ranges.empty();
+            return num == 0;
+        }
+
+        size_t size() const {
+            return num;
         }
 
+        /*
+         * Bytes allocated for the ranges.
+         */
+        size_t memory_usage() const {
+            return 4 * num * (narrow ? sizeof(uint32_t) : sizeof(uint64_t));
+        }
+
+        /*
+         * Inserts a range, which rebuilds the arrays.
+         */
         void add_range(DeltaRange const& range) {
-            ranges.insert(range.from, range);
-            ranges_inv.insert(range.to, range);
+            std::vector<DeltaRange> ranges;
+            ranges.reserve(num + 1);
+            for_each_range([&ranges](DeltaRange const& r) {
+                ranges.push_back(r);
+            });
+            ranges.push_back(range);
+            *this = DeltaFunction(ranges, max);
+        }
+
+        /*
+         * Calls f with every range in order of from.
+         */
+        template <class Function>
+        void for_each_range(Function f) const {
+            for (size_t i = 0; i < num; i++) {
+                uint64_t from = entry(FROMS, i);
+                f(DeltaRange{from, from + shift(SHIFTS, i)});
+            }
         }
 
         uint64_t evaluate(uint64_t const value) const {
-            if (!ranges.empty()) {
-                DeltaRange const& range = *ranges.search_range(value).begin();
-                return value + range.to - range.from;
+            if (num != 0) {
+                return lookup(FROMS, SHIFTS, value);
             } else {
                 return value;
             }
         }
 
         uint64_t evaluate_inv(uint64_t const value) const {
-            if (!ranges_inv.empty()) {
-                DeltaRange const& range = *ranges_inv.search_range(value).begin();
-                return value - range.to + range.from;
+            if (num != 0) {
+                return lookup(TOS, INV_SHIFTS, value);
             } else {
                 return value;
             }
         }
 
+        /*
+         * Evaluates num labels in place.
+         */
+        void evaluate_all(uint64_t* labels, size_t const num_labels) const {
+            if (num == 0) {
+                return;
+            }
+            if (narrow) {
+                for (size_t i = 0; i < num_labels; i++) {
+                    labels[i] = lookup<uint32_t, int32_t>(FROMS, SHIFTS, labels[i]);
+                }
+            } else {
+                for (size_t i = 0; i < num_labels; i++) {
+                    labels[i] = lookup<uint64_t, uint64_t>(FROMS, SHIFTS, labels[i]);
+                }
+            }
+        }
+
         NIEdge apply(NIEdge const& edge) const {
-            NIEdge new_edge;
-            new_edge.key = edge.key;
-            new_edge.lower = evaluate(edge.lower);
-            new_edge.upper = evaluate(edge.upper);
+            NIEdge new_edge = edge;
+            if (num == 0) {
+                return new_edge;
+            } else if (narrow) {
+                lookup_edge<uint32_t, int32_t>(new_edge.lower, new_edge.upper);
+            } else {
+                lookup_edge<uint64_t, uint64_t>(new_edge.lower, new_edge.upper);
+            }
             return new_edge;
         }
 
         DeltaFunction merge(DeltaFunction const& delta) const {
-            if (delta.ranges.empty()) {
+            if (delta.empty()) {
                 return *this;
-            } else if (ranges.empty()) {
+            } else if (empty()) {
                 return delta;
             }
-            DeltaFunction new_delta;
-            new_delta.max = delta.max;
-            for (DeltaRange range : ranges) {
-                new_delta.add_range({range.from, delta.evaluate(range.to)});
-            }
-            for (DeltaRange range : delta.ranges) {
+            std::vector<DeltaRange> ranges;
+            ranges.reserve(size() + delta.size());
+            for_each_range([&ranges, &delta](DeltaRange const& range) {
+                ranges.push_back({range.from, delta.evaluate(range.to)});
+            });
+            delta.for_each_range([this, &ranges](DeltaRange const& range) {
                 uint64_t from = evaluate_inv(range.from);
-                if (new_delta.ranges.count_key(from) == 0) {
-                    new_delta.add_range({from, range.to});
+                if (entry(FROMS, predecessor(FROMS, from)) != from) {
+                    ranges.push_back({from, range.to});
+                }
+            });
+            return DeltaFunction(ranges, delta.max);
+        }
+
+        /*
+         * Merges consecutive delta functions in the order they are applied.
+         * Neighbours are merged level by level like in a tournament, so
+         * every range takes part in log(deltas.size()) merges instead of
+         * one merge per delta behind it.
+         */
+        static DeltaFunction merge_all(std::vector<DeltaFunction> deltas) {
+            if (deltas.empty()) {
+                return DeltaFunction();
+            }
+            while (deltas.size() > 1) {
+                size_t merged = 0;
+                for (size_t i = 0; i + 1 < deltas.size(); i += 2) {
+                    deltas[merged++] = deltas[i].merge(deltas[i + 1]);
+                }
+                if (deltas.size() % 2 != 0) {
+                    deltas[merged++] = std::move(deltas.back());
                 }
+                deltas.resize(merged);
             }
-            return new_delta;
+            return deltas[0];
         }
     };
 
+    /*
+     * One operation of a batch update. Inserts append key with value to
+     * parent, removes only use key.
+     */
+    struct Update {
+        bool remove;
+        KeyType parent;
+        KeyType key;
+        ValueType value;
+    };
+
+    /*
+     * Edges of one version materialized as a new base, see
+     * prepare_checkpoint.
+     */
+    struct Checkpoint {
+        size_t version;
+        uint64_t max;
+        uint64_t max_edge;
+        NIEdgeTree edges;
+        NISortedEdgeTree bounds;
+    };
+
+    enum ChangeType {KEY_INSERTED, KEY_REMOVED, KEY_MOVED};
+
+    /*
+     * A key that differs between two versions, see diff.
+     */
+    struct Change {
+        ChangeType type;
+        KeyType key;
+    };
+
 private:
-    uint64_t init_max;
-    uint64_t max_edge;
-    NIEdgeTree edges;
-    std::vector<std::vector<DeltaFunction>> deltas;
-    DeltaFunction wip_delta;
+    // number of levels of the delta pyramid
+    static size_t const MAX_PATH = sizeof(size_t) * 8;
 
-    NIEdge get_edge(NIEdge const& edge, size_t const version, bool const use_wip) const {
-        size_t v;
-        if (version > max_version()) {
-            v = max_version();
-        } else {
-            v = version;
+    /*
+     * Open addressing hash index from the keys of added edges to their
+     * position. The writer fills slots with release stores after the edge
+     * is published, readers probe without locks. A full table is replaced
+     * by one twice the size, replaced tables are kept until the index is
+     * destroyed because readers may still probe them.
+     */
+    class AddedKeys {
+    private:
+        struct Table {
+            size_t shift;
+            size_t mask;
+            std::unique_ptr<std::atomic<size_t>[]> slots;
+
+            explicit Table(size_t const bits)
+            : shift(sizeof(size_t) * 8 - bits), mask((static_cast<size_t>(1) << bits) - 1),
+              slots(new std::atomic<size_t>[mask + 1]) {
+                for (size_t i = 0; i <= mask; i++) {
+                    slots[i].store(0, std::memory_order_relaxed);
+                }
+            }
+
+            size_t slot(KeyType const key) const {
+                return (std::hash<KeyType>()(key) * UINT64_C(0x9e3779b97f4a7c15)) >> shift;
+            }
+        };
+
+        std::vector<std::unique_ptr<Table>> tables;
+        std::atomic<Table*> current;
+        size_t num;
+
+        void insert_into(Table& table, KeyType const key, size_t const pos) {
+            size_t slot = table.slot(key);
+            while (table.slots[slot].load(std::memory_order_relaxed) != 0) {
+                slot = (slot + 1) & table.mask;
+            }
+            table.slots[slot].store(pos + 1, std::memory_order_release);
         }
-        if (v == 0) {
-            if (wip_delta.empty()) {
-                return edge;
-            } else {
-                return wip_delta.apply(edge);
+
+    public:
+        AddedKeys()
+        : tables(), current(nullptr), num(0) {
+            tables.emplace_back(new Table(4));
+            current.store(tables.back().get(), std::memory_order_relaxed);
+        }
+
+        AddedKeys(AddedKeys const& other)
+        : AddedKeys() {
+            *this = other;
+        }
+
+        AddedKeys& operator =(AddedKeys const& other) {
+            if (this == &other) {
+                return *this;
+            }
+            Table const& table = *other.current.load(std::memory_order_acquire);
+            tables.clear();
+            tables.emplace_back(new Table(sizeof(size_t) * 8 - table.shift));
+            for (size_t i = 0; i <= table.mask; i++) {
+                tables.back()->slots[i].store(table.slots[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
             }
+            current.store(tables.back().get(), std::memory_order_release);
+            num = other.num;
+            return *this;
         }
 
-        // power = floor(log2(version));
-        size_t power = sizeof(size_t) * 8 - 1;
-        while (v >> power == 0) {
-            power--;
+        /*
+         * Returns the position of key in added or false if it isn't there.
+         */
+        bool find(KeyType const key, ChunkedVector<NIEdge> const& added, size_t& pos) const {
+            Table const& table = *current.load(std::memory_order_acquire);
+            for (size_t slot = table.slot(key);; slot = (slot + 1) & table.mask) {
+                size_t entry = table.slots[slot].load(std::memory_order_acquire);
+                if (entry == 0) {
+                    return false;
+                } else if (added[entry - 1].key == key) {
+                    pos = entry - 1;
+                    return true;
+                }
+            }
         }
 
-        NIEdge new_edge = edge;
-        size_t current_version = 0;
-        while (current_version < v) {
-            size_t step = UINTMAX_C(1) << power;
-            new_edge = deltas[power][current_version / step].apply(new_edge);
-            current_version += step;
-            if (power > 0) {
-                power--;
-                while (((v >> power) & 1) == 0) {
-                    power--;
+        void insert(KeyType const key, size_t const pos, ChunkedVector<NIEdge> const& added) {
+            Table* table = current.load(std::memory_order_relaxed);
+            if (2 * (num + 1) > table->mask + 1) {
+                size_t bits = sizeof(size_t) * 8 - table->shift + 1;
+                std::unique_ptr<Table> grown(new Table(bits));
+                for (size_t i = 0; i < num; i++) {
+                    insert_into(*grown, added[i].key, i);
                 }
+                table = grown.get();
+                tables.push_back(std::move(grown));
+                current.store(table, std::memory_order_release);
             }
+            insert_into(*table, key, pos);
+            num++;
+        }
+
+        void clear() {
+            *this = AddedKeys();
+        }
+    };
+
+    /*
+     * Materialized versions, the edges that exist in a version stored as
+     * NIColumns with the labels of that version, so queries on them cost
+     * as much as on NestedIntervals. A version is materialized once it was
+     * queried min_hits times, the least recently used ones are dropped while the
+     * cache is over its budget of bytes. Readers share the cache, every
+     * access locks it. Copies start empty with the same settings.
+     */
+    class VersionCache {
+    private:
+        // hit counts are reset when they track more versions than this
+        static size_t const MAX_TRACKED = 4096;
+
+        struct Entry {
+            std::shared_ptr<NIEdgeColumns const> columns;
+            size_t bytes;
+            uint64_t last_use;
         };
 
-        if (use_wip) {
-            new_edge = wip_delta.apply(new_edge);
+        mutable std::mutex mutex;
+        size_t budget;
+        size_t min_hits;
+        size_t used;
+        uint64_t clock;
+        std::map<size_t, Entry> entries;
+        std::map<size_t, size_t> hits;
+
+        void evict() {
+            while (used > budget) {
+                auto lru = entries.begin();
+                for (auto it = entries.begin(); it != entries.end(); ++it) {
+                    if (it->second.last_use < lru->second.last_use) {
+                        lru = it;
+                    }
+                }
+                used -= lru->second.bytes;
+                entries.erase(lru);
+            }
         }
 
-        return new_edge;
+    public:
+        VersionCache()
+        : budget(0), min_hits(1), used(0), clock(0), entries(), hits() {
+        }
+
+        VersionCache(VersionCache const& other)
+        : VersionCache() {
+            std::lock_guard<std::mutex> lock(other.mutex);
+            budget = other.budget;
+            min_hits = other.min_hits;
+        }
+
+        VersionCache& operator =(VersionCache const& other) {
+            if (this != &other) {
+                size_t other_budget;
+                size_t other_min_hits;
+                {
+                    std::lock_guard<std::mutex> lock(other.mutex);
+                    other_budget = other.budget;
+                    other_min_hits = other.min_hits;
+                }
+                configure(other_budget, other_min_hits);
+            }
+            return *this;
+        }
+
+        void configure(size_t const budget, size_t const min_hits) {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->budget = budget;
+            this->min_hits = std::max<size_t>(1, min_hits);
+            hits.clear();
+            evict();
+        }
+
+        /*
+         * Returns the cached version or nullptr. Sets materialize if the
+         * version just became hot enough to be cached.
+         */
+        std::shared_ptr<NIEdgeColumns const> find(size_t const version, bool& materialize) {
+            std::lock_guard<std::mutex> lock(mutex);
+            materialize = false;
+            if (entries.empty() && budget == 0) {
+                return nullptr;
+            }
+            auto it = entries.find(version);
+            if (it != entries.end()) {
+                it->second.last_use = ++clock;
+                return it->second.columns;
+            }
+            if (budget > 0) {
+                if (hits.size() >= MAX_TRACKED) {
+                    hits.clear();
+                }
+                materialize = ++hits[version] == min_hits;
+            }
+            return nullptr;
+        }
+
+        void insert(size_t const version, std::shared_ptr<NIEdgeColumns const> columns, size_t const bytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (bytes > budget || entries.count(version) != 0) {
+                return;
+            }
+            entries[version] = {columns, bytes, ++clock};
+            hits.erase(version);
+            used += bytes;
+            evict();
+        }
+
+        size_t bytes() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return used;
+        }
+
+        void drop_before(size_t const version) {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (!entries.empty() && entries.begin()->first < version) {
+                used -= entries.begin()->second.bytes;
+                entries.erase(entries.begin());
+            }
+        }
+
+        std::vector<size_t> versions() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<size_t> result;
+            for (auto const& entry : entries) {
+                result.push_back(entry.first);
+            }
+            return result;
+        }
+    };
+
+    /*
+     * Background thread that merges the upper levels of the delta
+     * pyramid. Commits only append to level 0 and request the merges of
+     * the new version, the thread works through the requested versions in
+     * order. Copies drain the merger they are copied from and don't run
+     * a thread.
+     */
+    class Merger {
+    private:
+        std::function<void(size_t)> merge;
+        std::thread thread;
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        mutable std::condition_variable idle;
+        // versions up to requested have to be merged, up to done are
+        size_t requested;
+        size_t done;
+        bool stopping;
+
+        void work() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [this] { return stopping || done < requested; });
+                if (done == requested) {
+                    return;
+                }
+                size_t const size = done + 1;
+                lock.unlock();
+                merge(size);
+                lock.lock();
+                done = size;
+                if (done == requested) {
+                    idle.notify_all();
+                }
+            }
+        }
+
+    public:
+        Merger()
+        : merge(), thread(), mutex(), wake(), idle(), requested(0), done(0), stopping(false) {
+        }
+
+        Merger(Merger const& other)
+        : Merger() {
+            other.drain();
+        }
+
+        Merger& operator =(Merger const& other) {
+            if (this != &other) {
+                stop();
+                other.drain();
+            }
+            return *this;
+        }
+
+        ~Merger() {
+            stop();
+        }
+
+        bool running() const {
+            return thread.joinable();
+        }
+
+        /*
+         * Starts the thread, versions up to merged are merged already.
+         */
+        void start(size_t const merged, std::function<void(size_t)> merge) {
+            stop();
+            this->merge = std::move(merge);
+            requested = done = merged;
+            stopping = false;
+            thread = std::thread(&Merger::work, this);
+        }
+
+        /*
+         * Finishes the requested merges and stops the thread.
+         */
+        void stop() {
+            if (running()) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_one();
+                thread.join();
+            }
+        }
+
+        void request(size_t const version) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                requested = version;
+            }
+            wake.notify_one();
+        }
+
+        /*
+         * Waits until the requested merges are done.
+         */
+        void drain() const {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [this] { return done == requested; });
+        }
+
+        /*
+         * Declares the versions up to merged merged, the thread has to be
+         * drained.
+         */
+        void reset(size_t const merged) {
+            std::lock_guard<std::mutex> lock(mutex);
+            requested = done = merged;
+        }
+    };
+
+    // versions before base_version are answered by archive
+    std::shared_ptr<DeltaNI const> archive;
+    size_t base_version;
+    uint64_t init_max;
+    NIEdgeTree edges;
+    // every edge twice, keyed by its lower and by its upper bound
+    NISortedEdgeTree bounds;
+    // edges of keys inserted after the base was built, in the order of
+    // their labels, which are added_base + 2 * position + 1 and + 2
+    uint64_t added_base;
+    ChunkedVector<NIEdge> added;
+    AddedKeys added_keys;
+    // before deltas, so copies drain it before the deltas are copied
+    Merger merger;
+    // deltas[level][i] maps the labels of version i * 2^level to those of
+    // version (i + 1) * 2^level, relative to base_version. With background
+    // merges the upper levels may lag behind level 0.
+    ChunkedVector<DeltaFunction> deltas[MAX_PATH];
+    DeltaFunction wip_delta;
+    // not owned, every commit is appended to it
+    DeltaLog* log;
+    // edges up to this label are in the log
+    uint64_t logged_max_edge;
+    mutable VersionCache version_cache;
+
+    template <class T>
+    static void put(std::string& out, T const& value) {
+        out.append(reinterpret_cast<char const*>(&value), sizeof(T));
     }
 
-    bool exists(KeyType const key, size_t const version, bool const use_wip) const {
-        NIEdge edge;
-        if (!edges.search(key, edge)) {
+    template <class T>
+    static T get(char const*& data) {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        return value;
+    }
+
+    /*
+     * Log record of a commit: max, the number of ranges and of new edges,
+     * the ranges and every new edge with its value.
+     */
+    std::string commit_record() const {
+        static_assert(std::is_trivially_copyable<ValueType>::value, "logged values are written as raw bytes");
+        std::string record;
+        size_t const num_edges = (max_edge() - logged_max_edge) / 2;
+        put<uint64_t>(record, wip_delta.max);
+        put<uint64_t>(record, wip_delta.size());
+        put<uint64_t>(record, num_edges);
+        wip_delta.for_each_range([&record](DeltaRange const& range) {
+            put(record, range.from);
+            put(record, range.to);
+        });
+        for (uint64_t label = logged_max_edge + 1; label < max_edge(); label += 2) {
+            NIEdge edge;
+            ValueType value;
+            find_bound(label, edge);
+            Hierarchy<KeyType, ValueType>::values.search(edge.key, value);
+            put(record, edge.key);
+            // 64 bit bounds in every build, so logs stay portable
+            put<uint64_t>(record, edge.lower);
+            put<uint64_t>(record, edge.upper);
+            put(record, value);
+        }
+        return record;
+    }
+
+    /*
+     * Adds the new edges of a log record and returns its delta function.
+     */
+    DeltaFunction replay_record(char const* data, size_t const size) {
+        size_t const edge_size = sizeof(KeyType) + 2 * sizeof(uint64_t) + sizeof(ValueType);
+        char const* const end = data + size;
+        if (size < 3 * sizeof(uint64_t)) {
+            throw delta_log_corrupt();
+        }
+        uint64_t const max = get<uint64_t>(data);
+        uint64_t const num_ranges = get<uint64_t>(data);
+        uint64_t const num_edges = get<uint64_t>(data);
+        if (static_cast<uint64_t>(end - data) != num_ranges * 2 * sizeof(uint64_t) + num_edges * edge_size) {
+            throw delta_log_corrupt();
+        }
+        std::vector<DeltaRange> ranges(num_ranges);
+        for (DeltaRange& range : ranges) {
+            range.from = get<uint64_t>(data);
+            range.to = get<uint64_t>(data);
+        }
+        for (uint64_t i = 0; i < num_edges; i++) {
+            NIEdge edge;
+            edge.key = get<KeyType>(data);
+            edge.lower = get<uint64_t>(data);
+            edge.upper = get<uint64_t>(data);
+            ValueType value = get<ValueType>(data);
+            if (edge.lower != max_edge() + 1 || edge.upper != edge.lower + 1) {
+                throw delta_log_corrupt();
+            }
+            added.push_back(edge);
+            added_keys.insert(edge.key, added.size() - 1, added);
+            Hierarchy<KeyType, ValueType>::values.insert(edge.key, value);
+        }
+        return DeltaFunction::from_ranges(std::move(ranges), max);
+    }
+
+    void insert_bounds(NIEdge const& edge) {
+        bounds.insert(edge.lower, edge);
+        bounds.insert(edge.upper, edge);
+    }
+
+    uint64_t max_edge() const {
+        return added_base + 2 * added.size();
+    }
+
+    bool find_edge(KeyType const key, NIEdge& edge) const {
+        size_t pos;
+        if (edges.search(key, edge)) {
+            return true;
+        } else if (added_keys.find(key, added, pos)) {
+            edge = added[pos];
+            return true;
+        }
+        return false;
+    }
+
+    /*
+     * Finds the edge with a bound of base label.
+     */
+    bool find_bound(uint64_t const label, NIEdge& edge) const {
+        if (label <= added_base) {
+            return bounds.search(label, edge);
+        }
+        size_t pos = (label - added_base - 1) / 2;
+        if (pos >= added.size()) {
             return false;
         }
-        if (version == 0) {
-            if (use_wip && !wip_delta.empty()) {
-                return wip_delta.evaluate(edge.lower) < wip_delta.max;
-            } else {
-                return edge.lower < init_max;
+        edge = added[pos];
+        return true;
+    }
+
+    /*
+     * Calls f with every edge of the base and every added edge.
+     */
+    template <class Function>
+    void for_each_edge(Function f) const {
+        for (NIEdge const& e : edges) {
+            f(e);
+        }
+        size_t const num_added = added.size();
+        for (size_t i = 0; i < num_added; i++) {
+            f(added[i]);
+        }
+    }
+
+    /*
+     * Calls f with delta function index of level power or, if the merger
+     * hasn't published it yet, with the finer ones it is merged from.
+     */
+    template <class Function>
+    void visit_block(size_t const power, size_t const index, bool const reverse, Function& f) const {
+        if (index < deltas[power].size()) {
+            f(deltas[power][index]);
+        } else {
+            visit_block(power - 1, 2 * index + (reverse ? 1 : 0), reverse, f);
+            visit_block(power - 1, 2 * index + (reverse ? 0 : 1), reverse, f);
+        }
+    }
+
+    /*
+     * Calls f with the delta functions that map the labels of base_version
+     * to the labels of version, one per set bit of version - base_version,
+     * in the order they apply or in reverse.
+     */
+    template <class Function>
+    void for_each_delta(size_t const version, bool const reverse, Function f) const {
+        size_t const v = std::min(version, max_version()) - base_version;
+        for (size_t i = 0; i < MAX_PATH; i++) {
+            size_t const power = reverse ? i : MAX_PATH - 1 - i;
+            if (((v >> power) & 1) != 0) {
+                visit_block(power, (v >> power) - 1, reverse, f);
             }
+        }
+    }
+
+    NIEdge get_edge(NIEdge const& edge, size_t const version, bool const use_wip) const {
+        NIEdge new_edge = edge;
+        for_each_delta(version, false, [&new_edge](DeltaFunction const& delta) {
+            new_edge = delta.apply(new_edge);
+        });
+        if (use_wip && !wip_delta.empty()) {
+            new_edge = wip_delta.apply(new_edge);
+        }
+        return new_edge;
+    }
+
+    /*
+     * Maps a whole batch one level of the pyramid at a time, so every delta
+     * function is loaded once per batch instead of once per edge.
+     */
+    void get_edges(
+        std::vector<NIEdge> const& edges_in,
+        size_t const version,
+        bool const use_wip,
+        std::vector<NIEdge>& edges_out
+    ) const {
+        std::vector<DeltaFunction const*> path;
+        for_each_delta(version, false, [&path](DeltaFunction const& delta) {
+            path.push_back(&delta);
+        });
+        if (use_wip && !wip_delta.empty()) {
+            path.push_back(&wip_delta);
+        }
+
+        size_t const num = 2 * edges_in.size();
+        std::vector<uint64_t> labels(num);
+        for (size_t i = 0; i < edges_in.size(); i++) {
+            labels[2 * i] = edges_in[i].lower;
+            labels[2 * i + 1] = edges_in[i].upper;
+        }
+        for (DeltaFunction const* delta : path) {
+            delta->evaluate_all(labels.data(), labels.size());
+        }
+
+        edges_out.resize(edges_in.size());
+        for (size_t i = 0; i < edges_in.size(); i++) {
+            edges_out[i].key = edges_in[i].key;
+            edges_out[i].lower = labels[2 * i];
+            edges_out[i].upper = labels[2 * i + 1];
+        }
+    }
+
+    /*
+     * Maps a label of version back to the label of base_version.
+     */
+    uint64_t get_label_inv(uint64_t const label, size_t const version, bool const use_wip) const {
+        uint64_t base_label = label;
+        if (use_wip && !wip_delta.empty()) {
+            base_label = wip_delta.evaluate_inv(base_label);
+        }
+        for_each_delta(version, true, [&base_label](DeltaFunction const& delta) {
+            base_label = delta.evaluate_inv(base_label);
+        });
+        return base_label;
+    }
+
+    /*
+     * Labels greater or equal to this belong to removed edges.
+     */
+    uint64_t get_max(size_t const version, bool const use_wip) const {
+        if (use_wip && !wip_delta.empty()) {
+            return wip_delta.max;
+        } else if (version == base_version) {
+            return init_max;
         } else {
-            edge = get_edge(edge, version, use_wip);
-            if (use_wip && !wip_delta.empty()) {
-                return edge.lower < wip_delta.max;
-            } else {
-                return edge.lower < deltas[0][version - 1].max;
+            return deltas[0][version - base_version - 1].max;
+        }
+    }
+
+    /*
+     * Delta functions of a running batch update on top of the WIP delta.
+     * New deltas are queued and the queue is folded into one merged delta
+     * once its length reaches the square root of the merged size. That
+     * keeps both the labels lookups through the queue and the amortized
+     * folding cost at about sqrt(size) per update.
+     */
+    class Batch {
+    private:
+        DeltaFunction folded;
+        std::vector<DeltaFunction> queued;
+
+    public:
+        uint64_t max;
+
+        Batch(DeltaFunction const& wip, uint64_t const max)
+        : folded(wip), queued(), max(max) {
+        }
+
+        NIEdge apply(NIEdge const& edge) const {
+            NIEdge new_edge = folded.apply(edge);
+            for (DeltaFunction const& delta : queued) {
+                new_edge = delta.apply(new_edge);
+            }
+            return new_edge;
+        }
+
+        void add(DeltaFunction const& delta) {
+            max = delta.max;
+            queued.push_back(delta);
+            if (queued.size() * queued.size() > folded.size()) {
+                queued.insert(queued.begin(), folded);
+                folded = DeltaFunction::merge_all(std::move(queued));
+                queued.clear();
             }
         }
+
+        DeltaFunction finish() {
+            queued.insert(queued.begin(), folded);
+            return DeltaFunction::merge_all(std::move(queued));
+        }
+    };
+
+    /*
+     * Looks up the edge of key in the committed edges and in the edges new
+     * in the batch, mapped to the label space of the batch.
+     */
+    bool find_batch_edge(
+        KeyType const key,
+        Batch const& batch,
+        std::map<KeyType, NIEdge> const& new_edges,
+        NIEdge& edge
+    ) const {
+        auto it = new_edges.find(key);
+        if (it != new_edges.end()) {
+            edge = batch.apply(it->second);
+            return true;
+        } else if (find_edge(key, edge)) {
+            edge = batch.apply(get_edge(edge, max_version(), false));
+            return true;
+        }
+        return false;
+    }
+
+    bool exists(KeyType const key, size_t const version, bool const use_wip) const {
+        NIEdge edge;
+        if (!find_edge(key, edge)) {
+            return false;
+        }
+        return get_edge(edge, version, use_wip).lower < get_max(version, use_wip);
     }
 
     bool is_ancestor(KeyType const parent, KeyType const child, size_t const version, bool const use_wip) const {
         NIEdge parent_edge;
         NIEdge child_edge;
-        if (!edges.search(parent, parent_edge)) {
+        if (!find_edge(parent, parent_edge)) {
             throw deltani_invalid_key();
         }
-        if (!edges.search(child, child_edge)) {
+        if (!find_edge(child, child_edge)) {
             throw deltani_invalid_key();
         }
         parent_edge = get_edge(parent_edge, version, use_wip);
@@ -217,65 +1163,589 @@ private:
         return parent_edge.lower < child_edge.lower && parent_edge.upper > child_edge.upper;
     }
 
+    /*
+     * Walks left from the smaller lower bound in the label space of version.
+     * Labels are mapped back to version 0 to find their edge in bounds. An
+     * upper bound closes a subtree left of both keys, which is skipped as a
+     * whole. The first lower bound of an edge that also ends right of both
+     * keys belongs to the lowest common ancestor.
+     * This is not a stabbing search: every step costs an inverse and a
+     * forward walk through the pyramid plus a lookup in bounds, and there
+     * is one step per ancestor up to the result and per earlier sibling of
+     * each of them. Versions in the version cache are answered by a
+     * stabbing search over their columns instead.
+     */
+    KeyType lca(KeyType const a, KeyType const b, size_t const version, bool const use_wip) const {
+        NIEdge edge_a;
+        NIEdge edge_b;
+        if (!find_edge(a, edge_a) || !find_edge(b, edge_b)) {
+            throw deltani_invalid_key();
+        }
+        uint64_t const max = get_max(version, use_wip);
+        edge_a = get_edge(edge_a, version, use_wip);
+        edge_b = get_edge(edge_b, version, use_wip);
+        if (edge_a.lower >= max || edge_b.lower >= max) {
+            throw deltani_key_removed();
+        }
+        if (edge_a.lower <= edge_b.lower && edge_a.upper >= edge_b.upper) {
+            return a;
+        } else if (edge_b.lower <= edge_a.lower && edge_b.upper >= edge_a.upper) {
+            return b;
+        }
+
+        uint64_t const upper = std::max(edge_a.upper, edge_b.upper);
+        uint64_t label = std::min(edge_a.lower, edge_b.lower) - 1;
+        while (label > 0) {
+            NIEdge edge;
+            if (!find_bound(get_label_inv(label, version, use_wip), edge)) {
+                label--;
+                continue;
+            }
+            edge = get_edge(edge, version, use_wip);
+            if (edge.upper == label) {
+                label = edge.lower - 1;
+            } else if (edge.upper > upper) {
+                return edge.key;
+            } else {
+                label--;
+            }
+        }
+        throw hierarchy_no_common_ancestor();
+    }
+
+    /*
+     * Calls f with every child of key in the label space of version. The
+     * first label inside of the parent is the lower bound of its first
+     * child, the label behind the upper bound of a child is the lower bound
+     * of its next sibling, so every step skips a whole subtree.
+     */
+    template <class Function>
+    void for_each_child(KeyType const key, size_t const version, bool const use_wip, Function f) const {
+        NIEdge parent;
+        if (!find_edge(key, parent)) {
+            throw deltani_invalid_key();
+        }
+        parent = get_edge(parent, version, use_wip);
+        if (parent.lower >= get_max(version, use_wip)) {
+            throw deltani_key_removed();
+        }
+
+        uint64_t label = parent.lower + 1;
+        while (label < parent.upper) {
+            NIEdge edge;
+            if (!find_bound(get_label_inv(label, version, use_wip), edge)) {
+                label++;
+                continue;
+            }
+            edge = get_edge(edge, version, use_wip);
+            if (edge.lower == label) {
+                f(edge.key);
+                label = edge.upper + 1;
+            } else {
+                label++;
+            }
+        }
+    }
+
+    size_t num_childs(KeyType const key, size_t const version, bool const use_wip) const {
+        size_t num = 0;
+        for_each_child(key, version, use_wip, [&num](KeyType const child) {
+            num++;
+        });
+        return num;
+    }
+
+    /*
+     * Builds the columns of the edges that exist in version and returns
+     * their size in bytes: the key and bound columns and the key index.
+     */
+    std::shared_ptr<NIEdgeColumns const> materialize(size_t const version, size_t& bytes) const {
+        if (version < base_version) {
+            return archive->materialize(version, bytes);
+        }
+        uint64_t const max = get_max(version, false);
+        std::vector<NIEdge> materialized;
+        for_each_edge([this, version, max, &materialized](NIEdge const& e) {
+            NIEdge new_edge = get_edge(e, version, false);
+            if (new_edge.lower < max) {
+                materialized.push_back(new_edge);
+            }
+        });
+        bytes = materialized.size() * (2 * sizeof(KeyType) + 4 * sizeof(NIBound));
+        return std::make_shared<NIEdgeColumns const>(materialized);
+    }
+
+    /*
+     * Versions before base_version are gone if the history was truncated.
+     */
+    bool has_version(size_t const version) const {
+        return version <= max_version() && (version >= base_version || archive != nullptr);
+    }
+
+    std::shared_ptr<NIEdgeColumns const> cached_version(size_t const version) const {
+        bool hot;
+        std::shared_ptr<NIEdgeColumns const> cached = version_cache.find(version, hot);
+        if (hot) {
+            size_t bytes;
+            cached = materialize(version, bytes);
+            version_cache.insert(version, cached, bytes);
+        }
+        return cached;
+    }
+
+    /*
+     * Merges the fewest pyramid deltas that lead from version v1 to v2,
+     * the largest aligned block first.
+     */
+    DeltaFunction delta_between(size_t const v1, size_t const v2) const {
+        std::vector<DeltaFunction> path;
+        size_t v = v1 - base_version;
+        size_t const end = v2 - base_version;
+        while (v < end) {
+            size_t power = 0;
+            while (power + 1 < MAX_PATH && v % (static_cast<size_t>(2) << power) == 0
+                   && v + (static_cast<size_t>(2) << power) <= end) {
+                power++;
+            }
+            auto collect = [&path](DeltaFunction const& delta) {
+                path.push_back(delta);
+            };
+            visit_block(power, v >> power, false, collect);
+            v += static_cast<size_t>(1) << power;
+        }
+        return DeltaFunction::merge_all(std::move(path));
+    }
+
+    /*
+     * Merges the upper levels of the pyramid that complete once level 0
+     * has size delta functions. Levels above 0 have a single writer, either
+     * insert_delta or the merger.
+     */
+    void merge_levels(size_t size) {
+        for (size_t level = 0; size % 2 == 0; level++) {
+            deltas[level + 1].push_back(deltas[level][size - 2].merge(deltas[level][size - 1]));
+            size /= 2;
+        }
+    }
+
+    /*
+     * Archives the current base and its pyramid and installs checkpoint
+     * with an empty pyramid, new keys are added behind new_base.
+     */
+    void replace_base(Checkpoint checkpoint, uint64_t const new_base) {
+        std::shared_ptr<DeltaNI> old = std::make_shared<DeltaNI>();
+        old->archive = archive;
+        old->base_version = base_version;
+        old->init_max = init_max;
+        old->edges = std::move(edges);
+        old->bounds = std::move(bounds);
+        old->added_base = added_base;
+        old->added = std::move(added);
+        old->added_keys = added_keys;
+        for (size_t level = 0; level < MAX_PATH; level++) {
+            old->deltas[level] = std::move(deltas[level]);
+        }
+
+        archive = old;
+        base_version = checkpoint.version;
+        init_max = checkpoint.max;
+        edges = std::move(checkpoint.edges);
+        bounds = std::move(checkpoint.bounds);
+        added_base = new_base;
+        added.clear();
+        added_keys.clear();
+        for (size_t level = 0; level < MAX_PATH; level++) {
+            deltas[level].clear();
+        }
+        merger.reset(0);
+    }
+
+    /*
+     * Finds the parent of edge, which carries the labels of version, by
+     * walking left and skipping the subtrees of its earlier siblings. The
+     * first lower bound on the way encloses edge. Returns false for the
+     * root.
+     */
+    bool find_parent(NIEdge const& edge, size_t const version, NIEdge& parent) const {
+        uint64_t label = edge.lower - 1;
+        while (label > 0) {
+            NIEdge bound;
+            if (!find_bound(get_label_inv(label, version, false), bound)) {
+                label--;
+                continue;
+            }
+            bound = get_edge(bound, version, false);
+            if (bound.lower == label) {
+                parent = bound;
+                return true;
+            }
+            label = bound.lower - 1;
+        }
+        return false;
+    }
+
+    /*
+     * Looks up whether key exists in version and under which parent,
+     * versions older than the checkpoint are answered by the archive.
+     * has_parent is false for a root.
+     */
+    bool find_key_parent(KeyType const key, size_t const version, bool& has_parent, KeyType& parent) const {
+        if (version < base_version) {
+            return archive->find_key_parent(key, version, has_parent, parent);
+        }
+        NIEdge edge;
+        if (!find_edge(key, edge)) {
+            return false;
+        }
+        edge = get_edge(edge, version, false);
+        if (edge.lower >= get_max(version, false)) {
+            return false;
+        }
+        NIEdge parent_edge;
+        has_parent = find_parent(edge, version, parent_edge);
+        parent = parent_edge.key;
+        return true;
+    }
+
+    /*
+     * diff for v1 < base_version < v2. The changes before and after the
+     * checkpoint are found separately, by the archive and by this pyramid,
+     * which both hold base_version. A key that changed on both sides
+     * is compared between v1 and v2 directly, so the work still depends on
+     * the size of the change only.
+     */
+    std::vector<Change> diff_across_checkpoint(size_t const v1, size_t const v2) const {
+        std::map<KeyType, ChangeType> changes;
+        for (Change const& change : archive->diff(v1, base_version)) {
+            changes[change.key] = change.type;
+        }
+        for (Change const& change : diff(base_version, v2)) {
+            auto it = changes.find(change.key);
+            if (it == changes.end()) {
+                changes[change.key] = change.type;
+                continue;
+            }
+            bool has_parent1 = false;
+            bool has_parent2 = false;
+            KeyType parent1 = KeyType();
+            KeyType parent2 = KeyType();
+            bool const exists1 = find_key_parent(change.key, v1, has_parent1, parent1);
+            bool const exists2 = find_key_parent(change.key, v2, has_parent2, parent2);
+            if (!exists1 && exists2) {
+                it->second = KEY_INSERTED;
+            } else if (exists1 && !exists2) {
+                it->second = KEY_REMOVED;
+            } else if (exists1 && exists2
+                       && (has_parent1 != has_parent2 || (has_parent1 && parent1 != parent2))) {
+                it->second = KEY_MOVED;
+            } else {
+                changes.erase(it);
+            }
+        }
+
+        std::vector<Change> result;
+        result.reserve(changes.size());
+        for (auto const& change : changes) {
+            result.push_back({change.second, change.first});
+        }
+        return result;
+    }
+
 public:
     DeltaNI()
-    : Hierarchy<KeyType, ValueType>(), init_max(0), max_edge(0), edges(), deltas(), wip_delta() {
+    : Hierarchy<KeyType, ValueType>(), archive(), base_version(0), init_max(0), edges(), bounds(), added_base(0), added(), added_keys(), merger(), wip_delta(), log(nullptr), logged_max_edge(0), version_cache() {
     }
 
     DeltaNI(ValueTree values, NIEdgeTree edges)
-    : Hierarchy<KeyType, ValueType>(values), max_edge(0), edges(edges), deltas(), wip_delta() {
+    : Hierarchy<KeyType, ValueType>(values), archive(), base_version(0), edges(edges), bounds(), added_base(0), added(), added_keys(), merger(), wip_delta(), log(nullptr), logged_max_edge(0), version_cache() {
         // search root (edge with e.lower == 1)
         for (NIEdge& e : this->edges) {
             if (e.lower == 1) {
                 init_max = e.upper + 1;
             }
-            if (e.upper > max_edge) {
-                max_edge = e.upper;
+            if (e.upper > added_base) {
+                added_base = e.upper;
             }
+            insert_bounds(e);
         }
     }
 
     DeltaNI(ValueTree values, NIEdgeTree edges, uint64_t const max, uint64_t const max_edge)
-    : Hierarchy<KeyType, ValueType>(values), init_max(max), max_edge(max_edge), edges(edges), deltas(), wip_delta() {
+    : Hierarchy<KeyType, ValueType>(values), archive(), base_version(0), init_max(max), edges(edges), bounds(), added_base(max_edge), added(), added_keys(), merger(), wip_delta(), log(nullptr), logged_max_edge(0), version_cache() {
+        for (NIEdge& e : this->edges) {
+            insert_bounds(e);
+        }
     }
 
+    DeltaNI(DeltaNI const&) = default;
+    DeltaNI(DeltaNI&&) = default;
+    DeltaNI& operator =(DeltaNI const&) = default;
+    DeltaNI& operator =(DeltaNI&&) = default;
+
+    ~DeltaNI() {
+        // the merger writes to deltas, which are destroyed before it
+        merger.stop();
+    }
+
+    /*
+     * Readers of committed versions may run concurrently with one writer,
+     * a version is visible once commit has published it here.
+     */
     size_t max_version() const {
-        if (deltas.empty()) {
-            return 0;
-        } else {
-            return deltas[0].size();
-        }
+        return base_version + deltas[0].size();
+    }
+
+    /*
+     * Version of the current base edges, older versions are archived.
+     */
+    size_t checkpoint_version() const {
+        return base_version;
     }
 
     NIEdge get_edge(NIEdge const& edge) const {
         return get_edge(edge, max_version(), true);
     }
 
+    /*
+     * edge has to carry the labels of the base that version belongs to.
+     */
     NIEdge get_edge(NIEdge const& edge, size_t const version) const {
-        if (version > max_version()) {
+        if (!has_version(version)) {
             throw deltani_invalid_version();
+        } else if (version < base_version) {
+            return archive->get_edge(edge, version);
         }
         return get_edge(edge, version, false);
     }
 
+    /*
+     * Maps every edge of edges_in like get_edge and writes the results to
+     * edges_out in the same order.
+     */
+    void get_edges(std::vector<NIEdge> const& edges_in, std::vector<NIEdge>& edges_out) const {
+        get_edges(edges_in, max_version(), true, edges_out);
+    }
+
+    void get_edges(std::vector<NIEdge> const& edges_in, size_t const version, std::vector<NIEdge>& edges_out) const {
+        if (!has_version(version)) {
+            throw deltani_invalid_version();
+        } else if (version < base_version) {
+            archive->get_edges(edges_in, version, edges_out);
+            return;
+        }
+        get_edges(edges_in, version, false, edges_out);
+    }
+
+    /*
+     * Appends a new version. The merged deltas of the upper levels are
+     * published before level 0, so a reader that sees the new version
+     * also finds every delta function on its path. With background merges
+     * only level 0 is appended here and readers fall back to the lower
+     * levels until the merger caught up.
+     */
     size_t insert_delta(DeltaFunction const& delta) {
-        if (deltas.empty()) {
-            deltas.emplace_back();
-            deltas[0].push_back(delta);
-            return 1;
-        } else {
+        if (merger.running()) {
             deltas[0].push_back(delta);
-            size_t size = deltas[0].size();
-            for (size_t level = 0; size % 2 == 0; level++) {
-                if (level + 1 >= deltas.size()) {
-                    deltas.emplace_back();
-                }
-                DeltaFunction merged = deltas[level][size-2].merge(deltas[level][size-1]);
-                deltas[level + 1].push_back(merged);
-                size = deltas[level + 1].size();
+            merger.request(deltas[0].size());
+            return max_version();
+        }
+        std::vector<DeltaFunction> appended = {delta};
+        size_t size = deltas[0].size() + 1;
+        for (size_t level = 0; size % 2 == 0; level++) {
+            appended.push_back(deltas[level][size - 2].merge(appended.back()));
+            size /= 2;
+        }
+        for (size_t level = appended.size(); level-- > 0;) {
+            deltas[level].push_back(appended[level]);
+        }
+        return max_version();
+    }
+
+    /*
+     * Materializes the edges of version as a new base. Only reads, so it
+     * can run in a background thread next to readers and the writer.
+     * Labels are kept as they are in version, the deltas of newer versions
+     * stay valid.
+     */
+    Checkpoint prepare_checkpoint(size_t const version) const {
+        if (version < base_version || version > max_version()) {
+            throw deltani_invalid_version();
+        }
+        Checkpoint checkpoint;
+        checkpoint.version = version;
+        checkpoint.max = get_max(version, false);
+        checkpoint.max_edge = max_edge();
+        for_each_edge([this, &checkpoint, version](NIEdge const& e) {
+            if (e.upper <= checkpoint.max_edge) {
+                NIEdge new_edge = get_edge(e, version, false);
+                checkpoint.edges.insert(new_edge.key, new_edge);
+                checkpoint.bounds.insert(new_edge.lower, new_edge);
+                checkpoint.bounds.insert(new_edge.upper, new_edge);
+            }
+        });
+        return checkpoint;
+    }
+
+    /*
+     * Replaces the base by a prepared checkpoint. The current base and its
+     * delta pyramid are archived for versions older than the checkpoint,
+     * deltas of newer versions are rebuilt into a pyramid on top of the new
+     * base. Edges inserted between prepare_checkpoint and this call are
+     * carried over, their labels are the same in every version before their
+     * insert.
+     * Unlike prepare_checkpoint this must not run next to readers.
+     */
+    void install_checkpoint(Checkpoint checkpoint) {
+        if (checkpoint.version < base_version || checkpoint.version > max_version()) {
+            throw deltani_invalid_version();
+        }
+        merger.drain();
+        uint64_t const new_base = max_edge();
+        for (size_t i = (checkpoint.max_edge - added_base) / 2; i < added.size(); i++) {
+            checkpoint.edges.insert(added[i].key, added[i]);
+            checkpoint.bounds.insert(added[i].lower, added[i]);
+            checkpoint.bounds.insert(added[i].upper, added[i]);
+        }
+
+        std::vector<DeltaFunction> newer;
+        for (size_t v = checkpoint.version - base_version; v < deltas[0].size(); v++) {
+            newer.push_back(deltas[0][v]);
+        }
+        replace_base(std::move(checkpoint), new_base);
+        for (DeltaFunction const& delta : newer) {
+            insert_delta(delta);
+        }
+    }
+
+    void checkpoint(size_t const version) {
+        install_checkpoint(prepare_checkpoint(version));
+    }
+
+    /*
+     * Renumbers the bounds of the latest version densely and makes them
+     * the new base, like checkpoint(max_version()) but without the slots
+     * of removed keys and without the gap inserts leave in the base
+     * labels. The labels of every version are dense already, so the
+     * renumbered base is the latest version with the removed edges cut
+     * off. Older versions are archived with their own labels. A removed
+     * key is forgotten, it throws deltani_invalid_key afterwards instead
+     * of deltani_key_removed. Records of an attached log refer to the old
+     * base, so there must be no log and no uncommitted changes.
+     */
+    void compact() {
+        if (log != nullptr || !wip_delta.empty()) {
+            throw deltani_compact_error();
+        }
+        merger.drain();
+        size_t const version = max_version();
+        Checkpoint checkpoint;
+        checkpoint.version = version;
+        checkpoint.max = get_max(version, false);
+        checkpoint.max_edge = checkpoint.max - 1;
+        for_each_edge([this, &checkpoint, version](NIEdge const& e) {
+            NIEdge new_edge = get_edge(e, version, false);
+            if (new_edge.lower < checkpoint.max) {
+                checkpoint.edges.insert(new_edge.key, new_edge);
+                checkpoint.bounds.insert(new_edge.lower, new_edge);
+                checkpoint.bounds.insert(new_edge.upper, new_edge);
+            }
+        });
+        uint64_t const new_base = checkpoint.max_edge;
+        replace_base(std::move(checkpoint), new_base);
+    }
+
+    /*
+     * Bounds of the base edges and the added ones, every inserted key
+     * takes two more until the next compact.
+     */
+    uint64_t interval_space() const {
+        return max_edge();
+    }
+
+    /*
+     * Folds the history before version into the base edges like checkpoint
+     * but drops it instead of archiving it, which frees the delta pyramid
+     * of every older version. The pyramid is rebuilt for the versions from
+     * version on, they keep their numbers. Older versions throw
+     * deltani_invalid_version afterwards.
+     */
+    void truncate_before(size_t const version) {
+        if (version != base_version) {
+            install_checkpoint(prepare_checkpoint(version));
+        }
+        archive.reset();
+        version_cache.drop_before(version);
+    }
+
+    /*
+     * Moves the merges of the upper pyramid levels out of commit into a
+     * background thread, so a commit costs the same for every version.
+     * Readers combine lower levels until a merged level is ready. Turning
+     * it off waits for the pending merges.
+     */
+    void set_background_merges(bool const enabled) {
+        if (enabled && !merger.running()) {
+            merger.start(deltas[0].size(), [this](size_t const size) {
+                merge_levels(size);
+            });
+        } else if (!enabled) {
+            merger.stop();
+        }
+    }
+
+    /*
+     * Waits until the background merges of every committed version are
+     * done.
+     */
+    void wait_for_merges() const {
+        merger.drain();
+    }
+
+    /*
+     * Materializes committed versions once they were queried min_hits
+     * times and keeps the recently used ones within budget bytes. A budget
+     * of 0 turns the cache off and drops every cached version.
+     */
+    void set_version_cache(size_t const budget, size_t const min_hits = 2) {
+        version_cache.configure(budget, min_hits);
+    }
+
+    /*
+     * Materializes version right away if it fits the cache.
+     */
+    void cache_version(size_t const version) {
+        if (!has_version(version)) {
+            throw deltani_invalid_version();
+        }
+        size_t bytes;
+        std::shared_ptr<NIEdgeColumns const> materialized = materialize(version, bytes);
+        version_cache.insert(version, materialized, bytes);
+    }
+
+    std::vector<size_t> cached_versions() const {
+        return version_cache.versions();
+    }
+
+    size_t version_cache_bytes() const {
+        return version_cache.bytes();
+    }
+
+    /*
+     * Bytes taken by every level of the delta pyramid, up to the highest
+     * level in use: the slots of the level and the ranges of its delta
+     * functions.
+     */
+    std::vector<size_t> memory_usage() const {
+        std::vector<size_t> levels;
+        for (size_t level = 0; level < MAX_PATH && !deltas[level].empty(); level++) {
+            size_t const num = deltas[level].size();
+            size_t bytes = deltas[level].capacity() * sizeof(DeltaFunction);
+            for (size_t i = 0; i < num; i++) {
+                bytes += deltas[level][i].memory_usage();
             }
-            return deltas[0].size();
+            levels.push_back(bytes);
         }
+        return levels;
     }
 
     virtual bool exists(KeyType const key) const {
@@ -283,18 +1753,61 @@ public:
     }
 
     virtual bool exists(KeyType const key, size_t const version) const {
-        if (version > max_version()) {
+        if (!has_version(version)) {
             throw deltani_invalid_version();
         }
+        std::shared_ptr<NIEdgeColumns const> cached = cached_version(version);
+        size_t pos;
+        if (cached != nullptr) {
+            return cached->find(key, pos);
+        } else if (version < base_version) {
+            return archive->exists(key, version);
+        }
         return exists(key, version, false);
     }
 
+    virtual size_t num_childs(KeyType const key) const {
+        return num_childs(key, max_version(), true);
+    }
+
     virtual size_t num_childs(KeyType const key, size_t const version) const {
-        return 0;
+        if (!has_version(version)) {
+            throw deltani_invalid_version();
+        }
+        std::shared_ptr<NIEdgeColumns const> cached = cached_version(version);
+        size_t pos;
+        if (cached != nullptr && cached->find(key, pos)) {
+            return cached->num_children(pos);
+        } else if (version < base_version) {
+            return archive->num_childs(key, version);
+        }
+        return num_childs(key, version, false);
+    }
+
+    virtual void for_each_child(KeyType const key, KeyVisitor& visitor) const {
+        for_each_child(key, max_version(), true, [&visitor](KeyType const child) {
+            visitor.visit(child);
+        });
     }
 
-    virtual std::vector<KeyType> children(KeyType const key, size_t const version) const {
-        return std::vector<KeyType>();
+    virtual void for_each_child(KeyType const key, size_t const version, KeyVisitor& visitor) const {
+        if (!has_version(version)) {
+            throw deltani_invalid_version();
+        }
+        std::shared_ptr<NIEdgeColumns const> cached = cached_version(version);
+        size_t pos;
+        if (cached != nullptr && cached->find(key, pos)) {
+            cached->for_each_child(pos, [&cached, &visitor](size_t const child) {
+                visitor.visit(cached->key(child));
+            });
+            return;
+        } else if (version < base_version) {
+            archive->for_each_child(key, version, visitor);
+            return;
+        }
+        for_each_child(key, version, false, [&visitor](KeyType const child) {
+            visitor.visit(child);
+        });
     }
 
     virtual bool is_ancestor(KeyType const parent, KeyType const child) const {
@@ -302,65 +1815,275 @@ public:
     }
 
     virtual bool is_ancestor(KeyType const parent, KeyType const child, size_t const version) const {
-        if (version > max_version()) {
+        if (!has_version(version)) {
             throw deltani_invalid_version();
         }
+        std::shared_ptr<NIEdgeColumns const> cached = cached_version(version);
+        size_t parent_pos;
+        size_t child_pos;
+        if (cached != nullptr && cached->find(parent, parent_pos) && cached->find(child, child_pos)) {
+            return cached->contains(parent_pos, child_pos);
+        } else if (version < base_version) {
+            return archive->is_ancestor(parent, child, version);
+        }
         return is_ancestor(parent, child, version, false);
     }
 
+    virtual KeyType lca(KeyType const a, KeyType const b) const {
+        return lca(a, b, max_version(), true);
+    }
+
+    virtual KeyType lca(KeyType const a, KeyType const b, size_t const version) const {
+        if (!has_version(version)) {
+            throw deltani_invalid_version();
+        }
+        std::shared_ptr<NIEdgeColumns const> cached = cached_version(version);
+        size_t pos_a;
+        size_t pos_b;
+        if (cached != nullptr && cached->find(a, pos_a) && cached->find(b, pos_b)) {
+            size_t ancestor = cached->lca(pos_a, pos_b);
+            if (ancestor == cached->size()) {
+                throw hierarchy_no_common_ancestor();
+            }
+            return cached->key(ancestor);
+        } else if (version < base_version) {
+            return archive->lca(a, b, version);
+        }
+        return lca(a, b, version, false);
+    }
+
+    /*
+     * Keys that were inserted, removed or moved to another parent between
+     * versions v1 and v2, sorted by key. The children of a removed key are
+     * reported as removed too, the descendants of a moved key move along
+     * and aren't reported.
+     *
+     * Every edge whose position changed got a range of its own in one of
+     * the delta functions, merging them keeps the range bounds. So only the
+     * edges with a lower bound at a range bound of the merged delta are
+     * candidates, and the work depends on the size of the change instead
+     * of the size of the hierarchy.
+     */
+    std::vector<Change> diff(size_t const v1, size_t const v2) const {
+        if (v1 > v2 || !has_version(v1) || !has_version(v2)) {
+            throw deltani_invalid_version();
+        } else if (v1 < base_version && v2 <= base_version) {
+            return archive->diff(v1, v2);
+        } else if (v1 < base_version) {
+            return diff_across_checkpoint(v1, v2);
+        }
+
+        DeltaFunction const delta = delta_between(v1, v2);
+        uint64_t const max1 = get_max(v1, false);
+        uint64_t const max2 = get_max(v2, false);
+        std::map<KeyType, ChangeType> changes;
+
+        // removes the children of a removed key that didn't move away
+        std::function<void(KeyType)> remove_children = [&](KeyType const key) {
+            for_each_child(key, v1, false, [&](KeyType const child) {
+                NIEdge edge;
+                find_edge(child, edge);
+                if (delta.evaluate(get_edge(edge, v1, false).lower) >= max2) {
+                    changes[child] = KEY_REMOVED;
+                    remove_children(child);
+                }
+            });
+        };
+
+        delta.for_each_range([&](DeltaRange const& range) {
+            NIEdge edge;
+            if (range.from == 0 || !find_bound(get_label_inv(range.from, v1, false), edge)) {
+                return;
+            }
+            NIEdge const edge1 = get_edge(edge, v1, false);
+            if (edge1.lower != range.from || changes.count(edge1.key) != 0) {
+                return;
+            }
+            NIEdge const edge2 = delta.apply(edge1);
+            bool const exists1 = edge1.lower < max1;
+            bool const exists2 = edge2.lower < max2;
+            if (!exists1 && exists2) {
+                changes[edge1.key] = KEY_INSERTED;
+            } else if (exists1 && !exists2) {
+                changes[edge1.key] = KEY_REMOVED;
+                remove_children(edge1.key);
+            } else if (exists1 && exists2) {
+                NIEdge parent1;
+                NIEdge parent2;
+                bool const has_parent1 = find_parent(edge1, v1, parent1);
+                bool const has_parent2 = find_parent(edge2, v2, parent2);
+                if (has_parent1 != has_parent2 || (has_parent1 && parent1.key != parent2.key)) {
+                    changes[edge1.key] = KEY_MOVED;
+                }
+                // removed with its subtree and inserted again, only the
+                // first child sits on a range bound
+                if (edge2.upper - edge2.lower < edge1.upper - edge1.lower) {
+                    remove_children(edge1.key);
+                }
+            }
+        });
+
+        std::vector<Change> result;
+        result.reserve(changes.size());
+        for (auto const& change : changes) {
+            result.push_back({change.second, change.first});
+        }
+        return result;
+    }
+
+    /*
+     * Applies all updates in order as one unit. Every update sees the
+     * changes of the ones before it, if any of them fails none of them is
+     * applied.
+     */
+    void update(std::vector<Update> const& updates) {
+        Batch batch(wip_delta, get_max(max_version(), true));
+        std::map<KeyType, NIEdge> new_edges;
+        uint64_t next_edge = max_edge();
+
+        for (Update const& u : updates) {
+            DeltaFunction delta;
+            delta.add_range({1, 1});
+            if (u.remove) {
+                NIEdge edge;
+                if (!find_batch_edge(u.key, batch, new_edges, edge)) {
+                    throw deltani_invalid_key();
+                }
+                if (edge.lower >= batch.max) {
+                    throw deltani_key_removed();
+                }
+                if (edge.upper - edge.lower > 1) {
+                    throw deltani_key_has_children();
+                }
+                if (edge.lower == 1) {
+                    delta.max = 1;
+                } else {
+                    delta.max = batch.max - 2;
+                    delta.add_range({edge.lower, delta.max});
+                    delta.add_range({edge.upper + 1, edge.lower});
+                    delta.add_range({delta.max + 2, delta.max + 2});
+                }
+            } else {
+                NIEdge parent_edge;
+                if (!find_batch_edge(u.parent, batch, new_edges, parent_edge)) {
+                    throw deltani_invalid_key();
+                }
+                if (parent_edge.lower >= batch.max) {
+                    throw deltani_key_removed();
+                }
+
+                NIEdge inserting_edge;
+                if (find_batch_edge(u.key, batch, new_edges, inserting_edge)) {
+                    if (inserting_edge.lower < batch.max) {
+                        throw deltani_key_exists();
+                    }
+                } else {
+                    // the version's max ends up behind the new labels
+                    if (next_edge > std::numeric_limits<NIBound>::max() - 3) {
+                        throw deltani_bounds_exhausted();
+                    }
+                    // new labels are behind every other label in every version
+                    inserting_edge.key = u.key;
+                    inserting_edge.lower = next_edge + 1;
+                    inserting_edge.upper = next_edge + 2;
+                    new_edges[u.key] = inserting_edge;
+                    next_edge += 2;
+                }
+                // both bounds move to the end of parent, a key removed with
+                // its subtree leaves the removed descendants in between
+                delta.add_range({parent_edge.upper, parent_edge.upper + 2});
+                delta.add_range({inserting_edge.lower, parent_edge.upper});
+                if (inserting_edge.upper - inserting_edge.lower > 1) {
+                    delta.add_range({inserting_edge.lower + 1, inserting_edge.lower + 2});
+                }
+                delta.add_range({inserting_edge.upper, parent_edge.upper + 1});
+                delta.add_range({inserting_edge.upper + 1, inserting_edge.upper + 1});
+                delta.max = batch.max + 2;
+            }
+            batch.add(delta);
+        }
+
+        std::vector<NIEdge> appended(new_edges.size());
+        for (Update const& u : updates) {
+            auto it = new_edges.find(u.key);
+            if (!u.remove && it != new_edges.end()) {
+                appended[(it->second.lower - max_edge() - 1) / 2] = it->second;
+                Hierarchy<KeyType, ValueType>::values.insert(u.key, u.value);
+                new_edges.erase(it);
+            }
+        }
+        for (NIEdge const& e : appended) {
+            added.push_back(e);
+            added_keys.insert(e.key, added.size() - 1, added);
+        }
+        wip_delta = batch.finish();
+    }
+
     virtual void insert(KeyType const parent, KeyType const key, ValueType const value) {
+        update({{false, parent, key, value}});
+    }
+
+    virtual void remove(KeyType const key) {
+        update({{true, key, key, ValueType()}});
+    }
+
+    /*
+     * Moves key with its whole subtree to the end of the children of
+     * new_parent. The subtree is one block of labels, so the move is a
+     * single delta function with four ranges: the block and the labels it
+     * passes swap places.
+     */
+    void move_subtree(KeyType const key, KeyType const new_parent) {
+        NIEdge edge;
         NIEdge parent_edge;
-        if (!edges.search(parent, parent_edge)) {
+        if (!find_edge(key, edge) || !find_edge(new_parent, parent_edge)) {
             throw deltani_invalid_key();
         }
-        if (!exists(parent)) {
+        uint64_t const max = get_max(max_version(), true);
+        edge = get_edge(edge);
+        parent_edge = get_edge(parent_edge);
+        if (edge.lower >= max || parent_edge.lower >= max) {
             throw deltani_key_removed();
         }
-        parent_edge = get_edge(parent_edge);
-
-        if (exists(key)) {
-            throw deltani_key_exists();
+        if (edge.lower <= parent_edge.lower && parent_edge.upper <= edge.upper) {
+            throw deltani_invalid_move();
         }
 
-        NIEdge inserting_edge;
-        if (edges.search(key, inserting_edge)) {
-            inserting_edge = get_edge(inserting_edge);
-        } else {
-            inserting_edge.key = key;
-            inserting_edge.lower = max_edge + 1;
-            inserting_edge.upper = max_edge + 2;
-            edges.insert(key, inserting_edge);
-            Hierarchy<KeyType, ValueType>::values.insert(key, value);
-            max_edge += 2;
-        }
+        uint64_t const size = edge.upper - edge.lower + 1;
         DeltaFunction delta;
         delta.add_range({1, 1});
-        delta.add_range({parent_edge.upper, parent_edge.upper + 2});
-        delta.add_range({inserting_edge.lower, parent_edge.upper});
-        delta.add_range({inserting_edge.upper + 1, inserting_edge.upper + 1});
-        if (!wip_delta.empty()) {
-            delta.max = wip_delta.max + 2;
-        } else if (deltas.empty()) {
-            delta.max = init_max + 2;
+        if (parent_edge.upper > edge.upper) {
+            if (parent_edge.upper == edge.upper + 1) {
+                // already the last child of new_parent
+                return;
+            }
+            delta.add_range({edge.lower, parent_edge.upper - size});
+            delta.add_range({edge.upper + 1, edge.lower});
+            delta.add_range({parent_edge.upper, parent_edge.upper});
         } else {
-            delta.max = deltas[0][deltas[0].size() - 1].max + 2;
+            delta.add_range({parent_edge.upper, parent_edge.upper + size});
+            delta.add_range({edge.lower, parent_edge.upper});
+            delta.add_range({edge.upper + 1, edge.upper + 1});
         }
+        delta.max = max;
 
         wip_delta = wip_delta.merge(delta);
     }
 
-    virtual void remove(KeyType const key) {
+    /*
+     * Removes key with its whole subtree. The block of labels of the
+     * subtree moves behind max in a single delta function, so every key of
+     * the subtree is removed at once.
+     */
+    void remove_subtree(KeyType const key) {
         NIEdge edge;
-        if (!edges.search(key, edge)) {
+        if (!find_edge(key, edge)) {
             throw deltani_invalid_key();
         }
-        if (!exists(key)) {
-            throw deltani_key_removed();
-        }
+        uint64_t const max = get_max(max_version(), true);
         edge = get_edge(edge);
-
-        if (edge.upper - edge.lower > 1) {
-            throw deltani_key_has_children();
+        if (edge.lower >= max) {
+            throw deltani_key_removed();
         }
 
         DeltaFunction delta;
@@ -368,25 +2091,69 @@ public:
         if (edge.lower == 1) {
             delta.max = 1;
         } else {
-            if (!wip_delta.empty()) {
-                delta.max = wip_delta.max - 2;
-            } else if (deltas.empty()) {
-                delta.max = init_max - 2;
-            } else {
-                delta.max = deltas[0][deltas[0].size() - 1].max - 2;
-            }
+            delta.max = max - (edge.upper - edge.lower + 1);
             delta.add_range({edge.lower, delta.max});
             delta.add_range({edge.upper + 1, edge.lower});
-            delta.add_range({delta.max + 2, delta.max + 2});
+            delta.add_range({max, max});
         }
 
         wip_delta = wip_delta.merge(delta);
     }
 
+    /*
+     * Appends every following commit to log, which has to outlive this
+     * hierarchy or be detached by passing nullptr. Commits are written
+     * ahead of publishing the new version.
+     */
+    void set_log(DeltaLog* log) {
+        this->log = log;
+        logged_max_edge = max_edge();
+    }
+
+    /*
+     * Rebuilds the versions of a log written by set_log on top of the same
+     * edges this hierarchy was loaded from. The levels of the delta
+     * pyramid are merged in parallel on num_threads threads, 0 uses one
+     * per core. Returns the latest version.
+     */
+    size_t recover(std::string const& path, size_t const num_threads = 0) {
+        if (!deltas[0].empty() || !wip_delta.empty()) {
+            throw deltani_invalid_version();
+        }
+        merger.drain();
+        std::vector<std::vector<DeltaFunction>> levels(1);
+        DeltaLog::replay(path, [this, &levels](char const* data, size_t const size) {
+            levels[0].push_back(replay_record(data, size));
+        });
+
+        ThreadPool pool(num_threads);
+        while (levels.back().size() >= 2) {
+            std::vector<DeltaFunction> const& lower = levels.back();
+            std::vector<DeltaFunction> upper(lower.size() / 2);
+            pool.parallel_for(upper.size(), [&lower, &upper](size_t const i, size_t) {
+                upper[i] = lower[2 * i].merge(lower[2 * i + 1]);
+            });
+            levels.push_back(std::move(upper));
+        }
+        // level 0 last, it publishes the versions
+        for (size_t level = levels.size(); level-- > 0;) {
+            for (DeltaFunction const& delta : levels[level]) {
+                deltas[level].push_back(delta);
+            }
+        }
+        merger.reset(deltas[0].size());
+        logged_max_edge = max_edge();
+        return max_version();
+    }
+
     virtual size_t commit() {
         if (wip_delta.empty()) {
             return max_version();
         } else {
+            if (log != nullptr) {
+                log->append(commit_record());
+                logged_max_edge = max_edge();
+            }
             size_t new_version = insert_delta(wip_delta);
             wip_delta = DeltaFunction();
             return new_version;
@@ -22,6 +22,14 @@ public:
     }
 };
 
+class hierarchy_no_common_ancestor
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "hierarchy error: keys have no common ancestor";
+    }
+};
+
 template <
     class KeyType,
     class ValueType
@@ -30,6 +38,33 @@ class Hierarchy {
 public:
     typedef BPTree<ValueType, KeyType> ValueTree;
 
+    /*
+     * Receives result keys one at a time, so they don't have to be
+     * collected in a vector first.
+     */
+    class KeyVisitor {
+    public:
+        virtual ~KeyVisitor() {
+        }
+
+        virtual void visit(KeyType const key) = 0;
+    };
+
+private:
+    class VectorVisitor
+    : public KeyVisitor {
+    private:
+        std::vector<KeyType>& out;
+    public:
+        VectorVisitor(std::vector<KeyType>& out)
+        : out(out) {
+        }
+
+        virtual void visit(KeyType const key) {
+            out.push_back(key);
+        }
+    };
+
 protected:
     ValueTree values;
 
@@ -45,7 +80,7 @@ public:
     virtual ~Hierarchy() {
     }
 
-    ValueType search(KeyType key) {
+    virtual ValueType search(KeyType key) {
         ValueType v;
         if (!values.search(key, v)) {
             throw hierarchy_key_not_found();
@@ -55,8 +90,13 @@ public:
 
     virtual bool exists(KeyType const key, size_t const version) const = 0;
     virtual size_t num_childs(KeyType const key, size_t const version) const = 0;
-    virtual std::vector<KeyType> children(KeyType const key, size_t const version) const = 0;
+    virtual void for_each_child(KeyType const key, size_t const version, KeyVisitor& visitor) const = 0;
     virtual bool is_ancestor(KeyType const parent, KeyType const child, size_t const version) const = 0;
+    /*
+     * Lowest common ancestor, i.e. the deepest key that is a or b or an
+     * ancestor of both.
+     */
+    virtual KeyType lca(KeyType const a, KeyType const b, size_t const version) const = 0;
 
     virtual bool exists(KeyType const key) const {
         return exists(key, 0);
@@ -66,14 +106,46 @@ public:
         return num_childs(key, 0);
     }
 
-    virtual std::vector<KeyType> children(KeyType const key) const {
-        return children(key, 0);
-    };
+    virtual void for_each_child(KeyType const key, KeyVisitor& visitor) const {
+        for_each_child(key, 0, visitor);
+    }
+
+    /*
+     * Replaces the contents of out with the children of key. Passing the
+     * same vector to every call avoids allocations once it is big enough.
+     */
+    void children(KeyType const key, size_t const version, std::vector<KeyType>& out) const {
+        out.clear();
+        VectorVisitor visitor(out);
+        for_each_child(key, version, visitor);
+    }
+
+    void children(KeyType const key, std::vector<KeyType>& out) const {
+        out.clear();
+        VectorVisitor visitor(out);
+        for_each_child(key, visitor);
+    }
+
+    std::vector<KeyType> children(KeyType const key, size_t const version) const {
+        std::vector<KeyType> child_keys;
+        children(key, version, child_keys);
+        return child_keys;
+    }
+
+    std::vector<KeyType> children(KeyType const key) const {
+        std::vector<KeyType> child_keys;
+        children(key, child_keys);
+        return child_keys;
+    }
 
     virtual bool is_ancestor(KeyType const parent, KeyType const child) const {
         return is_ancestor(parent, child, 0);
     };
 
+    virtual KeyType lca(KeyType const a, KeyType const b) const {
+        return lca(a, b, 0);
+    }
+
     virtual void insert(KeyType const parent, KeyType const key, ValueType const value) = 0;
     virtual void remove(KeyType const key) = 0;
     virtual size_t commit() = 0;
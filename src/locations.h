@@ -17,6 +17,7 @@ struct Location {
 typedef Hierarchy<uint32_t, Location> LocationHierarchy;
 
 typedef AdjacencyList<uint32_t, Location> AdjLocation;
+typedef AdjacencyCSR<uint32_t, Location> CSRLocation;
 typedef NestedIntervals<uint32_t, Location> NILocation;
 typedef DeltaNI<uint32_t, Location> DeltaNILocation;
 
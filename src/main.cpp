@@ -1,11 +1,13 @@
 #include <config.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <readline/readline.h>
@@ -13,6 +15,7 @@
 #include <tclap/CmdLine.h>
 
 #include "locations.h"
+#include "ni_convert.h"
 #include "util.h"
 
 
@@ -30,6 +33,8 @@ char const HELP_STRING[] = ""
 "    print all children of a given id in given or latest version\n"
 "is_ancestor [<version>] <parent> <child>\n"
 "    determines if an id is an ancestor of another id in given or latest version\n"
+"lca [<version>] <id> <id>\n"
+"    print the lowest common ancestor of two ids in given or latest version\n"
 "insert <id> <name> <parent>\n"
 "    inserts a new entry with an id and a name and appends it to a parent\n"
 "remove <id>\n"
@@ -41,8 +46,9 @@ char const HELP_STRING[] = ""
 char const MODE_STR_ADJ[] = "adj";
 char const MODE_STR_NI[] = "ni";
 char const MODE_STR_DELTANI[] = "deltani";
+char const MODE_STR_CSR[] = "csr";
 
-std::vector<std::string> MODES = {MODE_STR_ADJ, MODE_STR_NI, MODE_STR_DELTANI};
+std::vector<std::string> MODES = {MODE_STR_ADJ, MODE_STR_NI, MODE_STR_DELTANI, MODE_STR_CSR};
 
 
 int main(int argc, char** argv) {
@@ -72,9 +78,36 @@ int main(int argc, char** argv) {
         "file path"
     );
 
+    TCLAP::SwitchArg adjArg(
+        "a",
+        "adjacency",
+        "Read adjacency edges as tree data and convert them in ni and deltani mode",
+        false
+    );
+    TCLAP::ValueArg<size_t> threadsArg(
+        "j",
+        "threads",
+        "Number of threads used for converting adjacency edges",
+        false,
+        std::max(1u, std::thread::hardware_concurrency()),
+        "number"
+    );
+
+    TCLAP::ValueArg<std::string> logArg(
+        "l",
+        "log",
+        "Recover commits from a delta log and append new ones to it in deltani mode",
+        false,
+        "",
+        "file path"
+    );
+
     args.add(modeArg);
     args.add(locsArg);
     args.add(treeArg);
+    args.add(adjArg);
+    args.add(threadsArg);
+    args.add(logArg);
 
     args.parse(argc, argv);
 
@@ -106,27 +139,55 @@ int main(int argc, char** argv) {
     }
 
     LocationHierarchy* hierarchy;
-    if (strMode == MODE_STR_DELTANI) {
-        NIEdgeTree edges;
-        cout << "reading ni edges... ";
-        cout.flush();
-        cout << "got " << read_ni_edges(tree_file, edges) << endl;
-        hierarchy = new DeltaNILocation(locs_tree, edges);
-    } else if (strMode == MODE_STR_NI) {
+    DeltaLog* log = nullptr;
+    if (strMode == MODE_STR_DELTANI || strMode == MODE_STR_NI) {
         NIEdgeTree edges;
-        cout << "reading ni edges... ";
-        cout.flush();
-        cout << "got " << read_ni_edges(tree_file, edges) << endl;
-        hierarchy = new NILocation(locs_tree, edges);
+        if (adjArg.getValue()) {
+            AdjacencyTree adj_edges;
+            cout << "reading edges... ";
+            cout.flush();
+            cout << "got " << read_adj_edges(tree_file, adj_edges) << endl;
+            cout << "converting edges... ";
+            cout.flush();
+            NIConverter<uint32_t> converter(adj_edges, threadsArg.getValue());
+            cout << "got " << converter.convert(edges) << endl;
+        } else {
+            cout << "reading ni edges... ";
+            cout.flush();
+            cout << "got " << read_ni_edges(tree_file, edges) << endl;
+        }
+        if (strMode == MODE_STR_DELTANI) {
+            DeltaNILocation* deltani = new DeltaNILocation(locs_tree, edges);
+            if (logArg.isSet()) {
+                cout << "recovering log... ";
+                cout.flush();
+                cout << "got version " << deltani->recover(logArg.getValue(), threadsArg.getValue()) << endl;
+                log = new DeltaLog(logArg.getValue());
+                deltani->set_log(log);
+            }
+            hierarchy = deltani;
+        } else {
+            hierarchy = new NILocation(locs_tree, edges);
+        }
     } else {
         AdjacencyTree edges;
         cout << "reading edges... ";
         cout.flush();
         cout << "got " << read_adj_edges(tree_file, edges) << endl;
-        hierarchy = new AdjLocation(locs_tree, edges);
+        if (strMode == MODE_STR_CSR) {
+            cout << "freezing edges... ";
+            cout.flush();
+            CSRLocation* frozen = new CSRLocation(AdjLocation(locs_tree, edges).freeze());
+            cout << "got " << frozen->size() << endl;
+            hierarchy = frozen;
+        } else {
+            hierarchy = new AdjLocation(locs_tree, edges);
+        }
     }
     tree_file.close();
 
+    // reused by every children command
+    vector<uint32_t> children;
     char *line;
     while(1) {
         line = readline("> ");
@@ -181,13 +242,12 @@ int main(int argc, char** argv) {
                 cout << "id " << key << " has " << num_childs << " childs" << endl;
             } else if (cmd == "ch" || cmd == "children") {
                 uint32_t key = stream_ui(stream);
-                vector<uint32_t> children;
                 if (stream.good()) {
                     uint32_t version = key;
                     key = stream_ui(stream);
-                    children = hierarchy->children(key, version);
+                    hierarchy->children(key, version, children);
                 } else {
-                    children = hierarchy->children(key);
+                    hierarchy->children(key, children);
                 }
                 cout << "children of id " << key << ":" << endl;
                 for (uint32_t child : children) {
@@ -210,6 +270,19 @@ int main(int argc, char** argv) {
                     cout << "NOT ";
                 }
                 cout << "ancestor of id " << child << endl;
+            } else if (cmd == "l" || cmd == "lca") {
+                uint32_t a = stream_ui(stream);
+                uint32_t b = stream_ui(stream);
+                uint32_t lca;
+                if (stream.good()) {
+                    uint32_t version = a;
+                    a = b;
+                    b = stream_ui(stream);
+                    lca = hierarchy->lca(a, b, version);
+                } else {
+                    lca = hierarchy->lca(a, b);
+                }
+                cout << "lowest common ancestor of ids " << a << " and " << b << " is " << lca << endl;
             } else if (cmd == "i" || cmd == "insert") {
                 uint32_t new_id = stream_ui(stream);
                 string new_name;
@@ -242,5 +315,6 @@ int main(int argc, char** argv) {
         add_history(line);
     }
     delete hierarchy;
+    delete log;
     return 0;
 }
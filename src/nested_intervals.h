@@ -1,12 +1,39 @@
 #ifndef _NESTED_INTERVALS_H
 #define _NESTED_INTERVALS_H
 
-#include <iostream>
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
+#include <limits>
 #include <vector>
 
 #include "bptree.h"
 #include "hierarchy.h"
+#include "ni_columns.h"
+
+class ni_key_exists
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "nested intervals: key already exists";
+    }
+};
+
+class ni_key_has_children
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "nested intervals: key has children";
+    }
+};
+
+class ni_gap_too_small
+: public hierarchy_error {
+public:
+    virtual const char* what() const noexcept {
+        return "nested intervals: gap leaves no room for inserts";
+    }
+};
 
 template <
     class KeyType,
@@ -17,95 +44,263 @@ class NestedIntervals
 public:
     struct NIEdge {
         KeyType key;
-        uint64_t lower;
-        uint64_t upper;
+        NIBound lower;
+        NIBound upper;
     };
 
     typedef BPTree<NIEdge, KeyType> NIEdgeTree;
-    typedef BPTree<NIEdge, uint64_t> NISortedEdgeTree;
+    typedef BPTree<NIEdge, NIBound> NISortedEdgeTree;
+    typedef NIColumns<KeyType> NIEdgeColumns;
     using ValueTree = typename Hierarchy<KeyType, ValueType>::ValueTree;
+    using KeyVisitor = typename Hierarchy<KeyType, ValueType>::KeyVisitor;
+
+    /*
+     * Lazy range over the children of a key. Iterating jumps from one child
+     * to the next behind its subtree.
+     */
+    class ChildRange {
+    private:
+        NIEdgeColumns const& columns;
+        size_t first;
+        size_t last;
+
+    public:
+        class iterator {
+        private:
+            NIEdgeColumns const& columns;
+            size_t pos;
+
+        public:
+            iterator(NIEdgeColumns const& columns, size_t const pos)
+            : columns(columns), pos(pos) {
+            }
+
+            KeyType operator *() const {
+                return columns.key(pos);
+            }
+
+            iterator& operator ++() {
+                pos = columns.subtree_end(pos);
+                return *this;
+            }
+
+            bool operator ==(iterator const& other) const {
+                return pos == other.pos;
+            }
+
+            bool operator !=(iterator const& other) const {
+                return pos != other.pos;
+            }
+        };
+
+        ChildRange(NIEdgeColumns const& columns, size_t const first, size_t const last)
+        : columns(columns), first(first), last(last) {
+        }
+
+        iterator begin() const {
+            return iterator(columns, first);
+        }
+
+        iterator end() const {
+            return iterator(columns, last);
+        }
+    };
+
+    // distance between neighbouring bounds after loading
+    static uint64_t const DEFAULT_GAP = 1024;
 
 private:
-    NIEdgeTree edges;
-    NISortedEdgeTree sorted_edges;
+    // an insert needs two free labels between two neighbouring bounds
+    static uint64_t const MIN_SPACING = 3;
+    // a new edge takes this fraction of the gap, so a parent fits many
+    // inserts before it has to be relabeled
+    static uint64_t const SLOTS_PER_GAP = 16;
+
+    uint64_t gap;
+    NIEdgeColumns columns;
+    size_t num_relabels;
+    // values of removed keys that are still in the value tree
+    size_t num_removed;
+
+    size_t position(KeyType const key) const {
+        size_t pos;
+        if (!columns.find(key, pos)) {
+            throw hierarchy_key_not_found();
+        }
+        return pos;
+    }
+
+    /*
+     * End of the label space that spreads num edges with gap between their
+     * bounds, or the greatest bound if that doesn't fit into NIBound.
+     */
+    uint64_t label_space(size_t const num) const {
+        uint64_t const limit = std::numeric_limits<NIBound>::max();
+        return std::min<uint64_t>((2 * num + 1) * gap, limit);
+    }
+
+    /*
+     * Relabels the smallest enclosing region of parent that is sparse enough
+     * to leave MIN_SPACING between all bounds after one more edge is added.
+     * The required spacing grows by one per level, so regions higher up are
+     * left sparser and relabeling stays amortized like in order maintenance
+     * structures. If even the roots are too dense, the whole label space is
+     * spread out again with the initial gap.
+     */
+    void make_room(size_t const parent) {
+        num_relabels++;
+        std::vector<size_t> path;
+        columns.ancestors(parent, path);
+        path.push_back(parent);
+        for (size_t level = 0; level < path.size(); level++) {
+            size_t region = path[path.size() - 1 - level];
+            size_t end = columns.subtree_end(region);
+            uint64_t bounds = 2 * (end - region - 1) + 2;
+            uint64_t width = columns.upper(region) - columns.lower(region);
+            if (width / (bounds + 1) >= MIN_SPACING + level) {
+                columns.relabel(region + 1, end, columns.lower(region), columns.upper(region));
+                return;
+            }
+        }
+        columns.relabel(0, columns.size(), 0, label_space(columns.size() + 1));
+    }
+
+    /*
+     * Rebuilds the value tree with only the values of stored keys, the
+     * tree can't delete single keys.
+     */
+    void drop_removed_values() {
+        ValueTree new_values;
+        ValueTree& values = Hierarchy<KeyType, ValueType>::values;
+        size_t pos;
+        for (auto it = values.begin(); it != values.end(); ++it) {
+            if (columns.find(it.key(), pos)) {
+                new_values.insert(it.key(), *it);
+            }
+        }
+        values = new_values;
+        num_removed = 0;
+    }
 
 public:
-    NestedIntervals(ValueTree values, NIEdgeTree edges, NISortedEdgeTree sorted_edges)
-    : Hierarchy<KeyType, ValueType>(values), edges(edges), sorted_edges(sorted_edges) {
+    NestedIntervals(ValueTree values, NIEdgeTree const& edges, uint64_t const gap = DEFAULT_GAP)
+    : Hierarchy<KeyType, ValueType>(values), gap(gap), columns(edges), num_relabels(0), num_removed(0) {
+        if (gap < MIN_SPACING) {
+            throw ni_gap_too_small();
+        }
+        columns.relabel(0, columns.size(), 0, label_space(columns.size()));
     }
 
-    NestedIntervals(ValueTree values, NIEdgeTree edges)
-    : Hierarchy<KeyType, ValueType>(values), edges(edges), sorted_edges() {
-        for (NIEdge& edge : edges) {
-            sorted_edges.insert(edge.lower, edge);
+    NestedIntervals(ValueTree values, NIEdgeColumns columns, uint64_t const gap = DEFAULT_GAP)
+    : Hierarchy<KeyType, ValueType>(values), gap(gap), columns(columns), num_relabels(0), num_removed(0) {
+        if (gap < MIN_SPACING) {
+            throw ni_gap_too_small();
         }
+        this->columns.relabel(0, this->columns.size(), 0, label_space(this->columns.size()));
     }
 
     NestedIntervals()
-    : Hierarchy<KeyType, ValueType>(), edges() {
+    : Hierarchy<KeyType, ValueType>(), gap(DEFAULT_GAP), columns(), num_relabels(0), num_removed(0) {
     }
 
     virtual bool exists(KeyType const key, size_t const version) const {
-        return Hierarchy<KeyType, ValueType>::values.count_key(key) > 0;
+        size_t pos;
+        return columns.find(key, pos);
     }
 
     virtual size_t num_childs(KeyType const key, size_t const version) const {
-        size_t num = 0;
-        NIEdge parent_edge;
-        if (!edges.search(key, parent_edge)) {
-            throw hierarchy_key_not_found();
-        }
-        uint64_t last = parent_edge.lower;
-        for (NIEdge& edge : sorted_edges.search_range(key)) {
-            if (edge.lower <= last) {
-                continue;
-            } else if (edge.lower > parent_edge.upper) {
-                break;
-            } else {
-                last = edge.upper;
-                num++;
-            }
-        }
-        return num;
+        return columns.num_children(position(key));
     }
 
-    virtual std::vector<KeyType> children(KeyType const key, size_t const version) const {
-        std::vector<KeyType> child_keys;
-        NIEdge parent_edge;
-        if (!edges.search(key, parent_edge)) {
-            throw hierarchy_key_not_found();
-        }
-        uint64_t last = parent_edge.lower;
-        for (NIEdge& edge : sorted_edges.search_range(key)) {
-            if (edge.lower <= last) {
-                continue;
-            } else if (edge.lower > parent_edge.upper) {
-                break;
-            } else {
-                last = edge.upper;
-                child_keys.push_back(edge.key);
-            }
-        }
-        return child_keys;
+    using Hierarchy<KeyType, ValueType>::for_each_child;
+
+    virtual void for_each_child(KeyType const key, size_t const version, KeyVisitor& visitor) const {
+        columns.for_each_child(position(key), [this, &visitor](size_t pos) {
+            visitor.visit(columns.key(pos));
+        });
+    }
+
+    ChildRange child_range(KeyType const key) const {
+        size_t const pos = position(key);
+        return ChildRange(columns, pos + 1, columns.subtree_end(pos));
     }
 
     virtual bool is_ancestor(KeyType const parent, KeyType const child, size_t const version) const {
-        NIEdge parent_edge;
-        NIEdge child_edge;
-        if (!edges.search(parent, parent_edge) || !edges.search(child, child_edge)) { 
+        return columns.contains(position(parent), position(child));
+    }
+
+    virtual KeyType lca(KeyType const a, KeyType const b, size_t const version) const {
+        size_t ancestor = columns.lca(position(a), position(b));
+        if (ancestor == columns.size()) {
+            throw hierarchy_no_common_ancestor();
+        }
+        return columns.key(ancestor);
+    }
+
+    virtual ValueType search(KeyType key) {
+        size_t pos;
+        if (!columns.find(key, pos)) {
             throw hierarchy_key_not_found();
         }
-        return parent_edge.lower < child_edge.lower && parent_edge.upper > child_edge.upper;
+        return Hierarchy<KeyType, ValueType>::search(key);
     }
 
+    /*
+     * Number of inserts that had to relabel a region first.
+     */
+    size_t relabels() const {
+        return num_relabels;
+    }
+
+    /*
+     * Appends key as last child of parent. The new edge gets a slot of a
+     * fixed width right behind the last child, so no other edge is
+     * relabeled unless the parent's free space is used up. Once less than
+     * two slots are left, the new edge takes half of the rest.
+     */
     virtual void insert(KeyType const parent, KeyType const key, ValueType const value) {
-        return;
+        size_t pos;
+        if (columns.find(key, pos)) {
+            throw ni_key_exists();
+        }
+        size_t parent_pos = position(parent);
+        if (columns.upper(parent_pos) - columns.last_bound(parent_pos) < MIN_SPACING) {
+            make_room(parent_pos);
+        }
+        uint64_t const last = columns.last_bound(parent_pos);
+        uint64_t const slot = std::max<uint64_t>(gap / SLOTS_PER_GAP, 1);
+        uint64_t const width = std::min(slot, (columns.upper(parent_pos) - last) / 2);
+        // make_room leaves at least MIN_SPACING unless the label space is used up
+        assert(width >= 1);
+        columns.append_child(parent_pos, key, last + 1, last + 1 + width);
+
+        ValueTree& values = Hierarchy<KeyType, ValueType>::values;
+        if (values.count_key(key) == 0) {
+            values.insert(key, value);
+        } else {
+            for (ValueType& v : values.search_iter(key)) {
+                v = value;
+            }
+        }
     }
 
     virtual void remove(KeyType const key) {
-        return;
+        size_t pos = position(key);
+        if (columns.num_descendants(pos) > 0) {
+            throw ni_key_has_children();
+        }
+        columns.erase(pos);
+        // search skips the value right away, the tree is rebuilt once
+        // removed values make up a quarter of it
+        num_removed++;
+        if (4 * num_removed > columns.size() + num_removed) {
+            drop_removed_values();
+        }
     }
 
+    /*
+     * Updates are applied in place, nested intervals don't keep versions.
+     */
     virtual size_t commit() {
         return 0;
     }
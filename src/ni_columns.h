@@ -0,0 +1,395 @@
+#ifndef _NI_COLUMNS_H
+#define _NI_COLUMNS_H
+
+#include <config.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef USE_AVX2
+#include <immintrin.h>
+#endif
+
+/*
+ * Type of the interval bounds. Narrow bounds halve the size of an edge and
+ * double the lanes of the SIMD kernels, but limit the label space to 2^32.
+ */
+#ifdef USE_NARROW_BOUNDS
+typedef uint32_t NIBound;
+#else
+typedef uint64_t NIBound;
+#endif
+
+/*
+ * Columnar storage for nested interval edges.
+ * Keys, lower and upper bounds are kept in separate densely packed arrays
+ * that are sorted by the lower bound, so the subtree of an edge is the
+ * contiguous slice behind it. A sorted key array maps keys to their lower
+ * bounds, which locate them in the lower bound column. The index doesn't
+ * depend on positions, so inserting or erasing an edge only touches its
+ * own index entry.
+ * Each edge also keeps the greatest bound inside of it, so appending a
+ * child doesn't have to look for the last one.
+ */
+template <class KeyType>
+class NIColumns {
+private:
+    std::vector<KeyType> keys;
+    std::vector<NIBound> lowers;
+    std::vector<NIBound> uppers;
+    // upper bound of the last child or the own lower bound
+    std::vector<NIBound> lasts;
+    std::vector<KeyType> index_keys;
+    std::vector<NIBound> index_lowers;
+
+#ifdef USE_AVX2
+    static size_t const LANES = sizeof(__m256i) / sizeof(NIBound);
+
+    static __m256i broadcast(NIBound const value) {
+#ifdef USE_NARROW_BOUNDS
+        return _mm256_set1_epi32(static_cast<int>(value));
+#else
+        return _mm256_set1_epi64x(static_cast<long long>(value));
+#endif
+    }
+
+    /*
+     * There is no unsigned compare, so bounds are compared with their sign
+     * bits flipped.
+     */
+    static __m256i flip(__m256i const v) {
+        return _mm256_xor_si256(v, broadcast(static_cast<NIBound>(1) << (sizeof(NIBound) * 8 - 1)));
+    }
+
+    /*
+     * Bit i is set if values[i] is greater than the flipped bound, for the
+     * LANES values at values.
+     */
+    static int greater_mask(NIBound const* values, __m256i const flipped_bound) {
+        __m256i v = flip(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(values)));
+#ifdef USE_NARROW_BOUNDS
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, flipped_bound)));
+#else
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, flipped_bound)));
+#endif
+    }
+#endif
+
+    /*
+     * Returns the greatest position i < end with values[i] > bound or end
+     * if there is none.
+     */
+    static size_t last_greater(NIBound const* values, size_t const end, NIBound const bound) {
+        size_t i = end;
+#ifdef USE_AVX2
+        __m256i const b = flip(broadcast(bound));
+        for (; i >= LANES; i -= LANES) {
+            int mask = greater_mask(values + i - LANES, b);
+            if (mask != 0) {
+                return i - LANES + (31 - __builtin_clz(mask));
+            }
+        }
+#endif
+        while (i > 0) {
+            i--;
+            if (values[i] > bound) {
+                return i;
+            }
+        }
+        return end;
+    }
+
+    void build_lasts() {
+        lasts = lowers;
+        std::vector<size_t> open;
+        for (size_t i = 0; i < keys.size(); i++) {
+            while (!open.empty() && uppers[open.back()] < lowers[i]) {
+                open.pop_back();
+            }
+            if (!open.empty()) {
+                lasts[open.back()] = uppers[i];
+            }
+            open.push_back(i);
+        }
+    }
+
+    void build_index() {
+        std::vector<size_t> order(keys.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            return keys[a] < keys[b];
+        });
+        index_keys.resize(order.size());
+        index_lowers.resize(order.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            index_keys[i] = keys[order[i]];
+            index_lowers[i] = lowers[order[i]];
+        }
+    }
+
+    size_t index_slot(KeyType const key) const {
+        return std::lower_bound(index_keys.begin(), index_keys.end(), key) - index_keys.begin();
+    }
+
+public:
+    NIColumns() {
+    }
+
+    /*
+     * Builds the columns from any iterable of edges with key, lower and
+     * upper members, e.g. an NIEdgeTree.
+     */
+    template <class EdgeIterable>
+    explicit NIColumns(EdgeIterable const& edges) {
+        struct Row {
+            KeyType key;
+            NIBound lower;
+            NIBound upper;
+        };
+        std::vector<Row> rows;
+        for (auto const& edge : edges) {
+            rows.push_back({edge.key, edge.lower, edge.upper});
+        }
+        std::sort(rows.begin(), rows.end(), [](Row const& a, Row const& b) {
+            return a.lower < b.lower;
+        });
+        keys.reserve(rows.size());
+        lowers.reserve(rows.size());
+        uppers.reserve(rows.size());
+        for (Row const& row : rows) {
+            keys.push_back(row.key);
+            lowers.push_back(row.lower);
+            uppers.push_back(row.upper);
+        }
+        build_lasts();
+        build_index();
+    }
+
+    size_t size() const {
+        return keys.size();
+    }
+
+    bool empty() const {
+        return keys.empty();
+    }
+
+    KeyType key(size_t const pos) const {
+        return keys[pos];
+    }
+
+    NIBound lower(size_t const pos) const {
+        return lowers[pos];
+    }
+
+    NIBound upper(size_t const pos) const {
+        return uppers[pos];
+    }
+
+    /*
+     * Searches the position of key.
+     * Returns false if the key is not stored.
+     */
+    bool find(KeyType const key, size_t& pos) const {
+        auto it = std::lower_bound(index_keys.begin(), index_keys.end(), key);
+        if (it == index_keys.end() || *it != key) {
+            return false;
+        }
+        NIBound const lower = index_lowers[it - index_keys.begin()];
+        pos = std::lower_bound(lowers.begin(), lowers.end(), lower) - lowers.begin();
+        return true;
+    }
+
+    /*
+     * Returns the position behind the last descendant of pos, so
+     * [pos + 1, subtree_end(pos)) are exactly the descendants of pos.
+     */
+    size_t subtree_end(size_t const pos) const {
+        NIBound const upper = uppers[pos];
+        // gallop first, most subtrees are small
+        size_t step = 1;
+        size_t begin = pos + 1;
+        while (begin + step < lowers.size() && lowers[begin + step] < upper) {
+            begin += step;
+            step *= 2;
+        }
+        size_t end = std::min(begin + step + 1, lowers.size());
+        return std::upper_bound(lowers.begin() + begin, lowers.begin() + end, upper)
+            - lowers.begin();
+    }
+
+    size_t num_descendants(size_t const pos) const {
+        return subtree_end(pos) - pos - 1;
+    }
+
+    /*
+     * Calls f with the position of every direct child of pos.
+     * Subtrees of the children are skipped instead of scanned.
+     */
+    template <class Function>
+    void for_each_child(size_t const pos, Function f) const {
+        size_t const end = subtree_end(pos);
+        size_t i = pos + 1;
+        while (i < end) {
+            f(i);
+            i = subtree_end(i);
+        }
+    }
+
+    /*
+     * Returns a bound inside of pos that no child of pos ends behind, i.e.
+     * the upper bound of its last child or its own lower bound. After an
+     * erase it may still be the bound of the erased child until the next
+     * relabel, which only leaves those labels unused.
+     */
+    NIBound last_bound(size_t const pos) const {
+        return lasts[pos];
+    }
+
+    size_t num_children(size_t const pos) const {
+        size_t num = 0;
+        for_each_child(pos, [&num](size_t) {
+            num++;
+        });
+        return num;
+    }
+
+    bool contains(size_t const parent, size_t const child) const {
+        return lowers[parent] < lowers[child] && uppers[parent] > uppers[child];
+    }
+
+    /*
+     * Calls f with the position of every ancestor of pos, root first.
+     * Descends from the first root and skips the subtrees in front of each
+     * ancestor, so the work depends on the path to pos and the siblings
+     * along it instead of on pos.
+     */
+    template <class Function>
+    void for_each_ancestor(size_t const pos, Function f) const {
+        size_t i = 0;
+        while (i < pos) {
+            size_t const end = subtree_end(i);
+            if (end > pos) {
+                f(i);
+                i++;
+            } else {
+                i = end;
+            }
+        }
+    }
+
+    /*
+     * Appends the positions of all ancestors of pos, root first.
+     */
+    void ancestors(size_t const pos, std::vector<size_t>& out) const {
+        for_each_ancestor(pos, [&out](size_t const ancestor) {
+            out.push_back(ancestor);
+        });
+    }
+
+    /*
+     * Stabbing search for the deepest edge in front of pos whose upper bound
+     * is greater than upper. Returns size() if there is none.
+     */
+    size_t enclosing(size_t const pos, NIBound const upper) const {
+        size_t found = last_greater(uppers.data(), pos, upper);
+        return found == pos ? size() : found;
+    }
+
+    /*
+     * Position of the lowest common ancestor of a and b or size() if there
+     * is none. The columns are sorted by lower bound, so it is the first
+     * edge in front of the left one that also ends behind the right one.
+     */
+    size_t lca(size_t a, size_t b) const {
+        if (b < a) {
+            std::swap(a, b);
+        }
+        NIBound upper = std::max(uppers[a], uppers[b]);
+        if (uppers[a] >= upper) {
+            return a;
+        }
+        return enclosing(a, upper);
+    }
+
+    size_t depth(size_t const pos) const {
+        size_t num = 0;
+        for_each_ancestor(pos, [&num](size_t) {
+            num++;
+        });
+        return num;
+    }
+
+    /*
+     * Appends an edge as last child of parent. The caller has to make sure
+     * that lower is greater than last_bound(parent) and upper is less than
+     * the upper bound of parent.
+     * The columns and the index are arrays, so this moves the entries
+     * behind the new edge and behind the key's index slot with one memmove
+     * each.
+     */
+    void append_child(size_t const parent, KeyType const key, NIBound const lower, NIBound const upper) {
+        size_t const pos = subtree_end(parent);
+        keys.insert(keys.begin() + pos, key);
+        lowers.insert(lowers.begin() + pos, lower);
+        uppers.insert(uppers.begin() + pos, upper);
+        lasts.insert(lasts.begin() + pos, lower);
+        lasts[parent] = upper;
+        size_t const slot = index_slot(key);
+        index_keys.insert(index_keys.begin() + slot, key);
+        index_lowers.insert(index_lowers.begin() + slot, lower);
+    }
+
+    void erase(size_t const pos) {
+        size_t const slot = index_slot(keys[pos]);
+        index_keys.erase(index_keys.begin() + slot);
+        index_lowers.erase(index_lowers.begin() + slot);
+        keys.erase(keys.begin() + pos);
+        lowers.erase(lowers.begin() + pos);
+        uppers.erase(uppers.begin() + pos);
+        lasts.erase(lasts.begin() + pos);
+    }
+
+    /*
+     * Spreads the bounds of all edges in [begin, end) evenly over the open
+     * interval (low, high), keeping their order. [begin, end) has to consist
+     * of whole subtrees and high has to fit into NIBound. If (low, high) are
+     * the bounds of the edge in front of begin, [begin, end) have to be its
+     * descendants and its last bound is updated as well.
+     * Returns the distance between two neighbouring bounds.
+     */
+    uint64_t relabel(size_t const begin, size_t const end, uint64_t const low, uint64_t const high) {
+        uint64_t const step = (high - low) / (2 * (end - begin) + 1);
+        uint64_t label = low;
+        std::vector<size_t> open;
+        for (size_t i = begin; i < end; i++) {
+            // compare against old labels, uppers are only overwritten on pop
+            while (!open.empty() && uppers[open.back()] < lowers[i]) {
+                lasts[open.back()] = label;
+                label += step;
+                uppers[open.back()] = label;
+                open.pop_back();
+            }
+            label += step;
+            lowers[i] = label;
+            open.push_back(i);
+        }
+        while (!open.empty()) {
+            lasts[open.back()] = label;
+            label += step;
+            uppers[open.back()] = label;
+            open.pop_back();
+        }
+        if (begin > 0 && lowers[begin - 1] == low && uppers[begin - 1] == high) {
+            lasts[begin - 1] = label;
+        }
+        for (size_t i = begin; i < end; i++) {
+            index_lowers[index_slot(keys[i])] = lowers[i];
+        }
+        return step;
+    }
+};
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef _NI_CONVERT_H
+#define _NI_CONVERT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "ni_columns.h"
+#include "thread_pool.h"
+
+/*
+ * Converts adjacency edges into a nested interval encoding.
+ *
+ * Keys are mapped to dense ids and the children are gathered in compressed
+ * sparse row form. The tree is then cut into a small top part and a frontier
+ * of independent subtrees. Subtree sizes of the frontier are counted in
+ * parallel, offsets of the top part are assigned serially by a prefix sum
+ * over the sizes, and each frontier subtree is labeled in parallel starting
+ * at its offset. All traversals use explicit stacks, so the depth of the
+ * tree is only limited by memory.
+ *
+ * Labels start at 1 and every key gets lower and upper bounds such that
+ * upper - lower + 1 is twice its subtree size, like the NI edge files.
+ */
+template <class KeyType>
+class NIConverter {
+private:
+    std::vector<KeyType> keys;
+    std::vector<size_t> offsets;
+    std::vector<size_t> children;
+    std::vector<size_t> roots;
+    std::vector<uint64_t> sizes;
+    std::vector<NIBound> lowers;
+    ThreadPool pool;
+
+    size_t dense_id(KeyType const key) const {
+        return std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+    }
+
+    template <class Function>
+    void parallel_for(size_t const num, Function f) {
+        pool.parallel_for(num, [&f](size_t i, size_t) {
+            f(i);
+        });
+    }
+
+    uint64_t count_subtree(size_t const root) const {
+        uint64_t size = 0;
+        std::vector<size_t> dfs_stack(1, root);
+        while (!dfs_stack.empty()) {
+            size_t id = dfs_stack.back();
+            dfs_stack.pop_back();
+            size++;
+            dfs_stack.insert(dfs_stack.end(), children.begin() + offsets[id], children.begin() + offsets[id + 1]);
+        }
+        return size;
+    }
+
+    /*
+     * Preorder labeling of the subtree below root, starting at lower.
+     * Sizes of inner nodes are not needed, an upper bound is assigned when
+     * the node is left again.
+     */
+    void label_subtree(size_t const root, uint64_t const lower, std::vector<NIBound>& uppers) {
+        uint64_t label = lower;
+        // (id, index of next child)
+        std::vector<std::pair<size_t, size_t>> dfs_stack;
+        lowers[root] = label++;
+        dfs_stack.push_back({root, offsets[root]});
+        while (!dfs_stack.empty()) {
+            std::pair<size_t, size_t>& top = dfs_stack.back();
+            if (top.second < offsets[top.first + 1]) {
+                size_t child = children[top.second++];
+                lowers[child] = label++;
+                dfs_stack.push_back({child, offsets[child]});
+            } else {
+                uppers[top.first] = label++;
+                dfs_stack.pop_back();
+            }
+        }
+    }
+
+public:
+    /*
+     * Reads all edges from an iterable of adjacency edges with parent and
+     * child members, e.g. an AdjacencyTree. Children keep the order in which
+     * their edges are read.
+     */
+    template <class EdgeIterable>
+    NIConverter(EdgeIterable const& edges, size_t const num_threads)
+    : pool(std::max<size_t>(1, num_threads)) {
+        std::vector<KeyType> parents;
+        std::vector<KeyType> child_keys;
+        for (auto const& edge : edges) {
+            parents.push_back(edge.parent);
+            child_keys.push_back(edge.child);
+        }
+        size_t const num_edges = parents.size();
+
+        // sort chunks in parallel and merge them pairwise
+        keys.resize(2 * num_edges);
+        std::copy(parents.begin(), parents.end(), keys.begin());
+        std::copy(child_keys.begin(), child_keys.end(), keys.begin() + num_edges);
+        size_t const num_chunks = pool.size();
+        size_t chunk = (keys.size() + num_chunks - 1) / num_chunks;
+        parallel_for(num_chunks, [this, chunk](size_t i) {
+            size_t begin = std::min(i * chunk, keys.size());
+            size_t end = std::min(begin + chunk, keys.size());
+            std::sort(keys.begin() + begin, keys.begin() + end);
+        });
+        for (; chunk < keys.size(); chunk *= 2) {
+            parallel_for((keys.size() + 2 * chunk - 1) / (2 * chunk), [this, chunk](size_t i) {
+                size_t begin = 2 * i * chunk;
+                size_t middle = std::min(begin + chunk, keys.size());
+                size_t end = std::min(middle + chunk, keys.size());
+                std::inplace_merge(keys.begin() + begin, keys.begin() + middle, keys.begin() + end);
+            });
+        }
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        std::vector<size_t> parent_ids(num_edges);
+        children.resize(num_edges);
+        size_t const block = 4096;
+        parallel_for((num_edges + block - 1) / block, [&](size_t i) {
+            for (size_t e = i * block; e < std::min((i + 1) * block, num_edges); e++) {
+                parent_ids[e] = dense_id(parents[e]);
+                children[e] = dense_id(child_keys[e]);
+            }
+        });
+
+        // counting sort by parent, children keep their order
+        offsets.assign(keys.size() + 1, 0);
+        std::vector<bool> has_parent(keys.size(), false);
+        for (size_t e = 0; e < num_edges; e++) {
+            offsets[parent_ids[e] + 1]++;
+            has_parent[children[e]] = true;
+        }
+        for (size_t i = 0; i < keys.size(); i++) {
+            offsets[i + 1] += offsets[i];
+        }
+        std::vector<size_t> sorted(num_edges);
+        std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t e = 0; e < num_edges; e++) {
+            sorted[fill[parent_ids[e]]++] = children[e];
+        }
+        children.swap(sorted);
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (!has_parent[i]) {
+                roots.push_back(i);
+            }
+        }
+    }
+
+    size_t size() const {
+        return keys.size();
+    }
+
+    /*
+     * Computes the labels and inserts one NI edge per key into output, in
+     * ascending key order.
+     * Returns the number of inserted edges.
+     */
+    template <class NIEdgeTree>
+    size_t convert(NIEdgeTree& output) {
+        sizes.assign(keys.size(), 0);
+        lowers.assign(keys.size(), 0);
+        std::vector<NIBound> uppers(keys.size(), 0);
+
+        // expand the top part breadth first until there are enough subtrees
+        // to keep all threads busy
+        std::vector<size_t> top;
+        std::vector<size_t> frontier(roots);
+        size_t const min_frontier = 16 * pool.size();
+        bool expanded = true;
+        while (expanded && frontier.size() < min_frontier) {
+            expanded = false;
+            std::vector<size_t> next;
+            for (size_t id : frontier) {
+                if (offsets[id] == offsets[id + 1]) {
+                    next.push_back(id);
+                } else {
+                    expanded = true;
+                    top.push_back(id);
+                    next.insert(next.end(), children.begin() + offsets[id], children.begin() + offsets[id + 1]);
+                }
+            }
+            frontier.swap(next);
+        }
+
+        parallel_for(frontier.size(), [this, &frontier](size_t i) {
+            sizes[frontier[i]] = count_subtree(frontier[i]);
+        });
+        // top is in breadth first order, so children are summed up before
+        // their parents
+        for (size_t i = top.size(); i-- > 0;) {
+            size_t id = top[i];
+            sizes[id] = 1;
+            for (size_t c = offsets[id]; c < offsets[id + 1]; c++) {
+                sizes[id] += sizes[children[c]];
+            }
+        }
+
+        // prefix sums over the subtree sizes give every child its lower bound
+        uint64_t label = 1;
+        for (size_t id : roots) {
+            lowers[id] = label;
+            uppers[id] = label + 2 * sizes[id] - 1;
+            label = uppers[id] + 1;
+        }
+        for (size_t id : top) {
+            label = lowers[id] + 1;
+            for (size_t c = offsets[id]; c < offsets[id + 1]; c++) {
+                size_t child = children[c];
+                lowers[child] = label;
+                uppers[child] = label + 2 * sizes[child] - 1;
+                label = uppers[child] + 1;
+            }
+        }
+
+        parallel_for(frontier.size(), [this, &frontier, &uppers](size_t i) {
+            label_subtree(frontier[i], lowers[frontier[i]], uppers);
+        });
+
+        for (size_t i = 0; i < keys.size(); i++) {
+            output.insert(keys[i], {keys[i], lowers[i], uppers[i]});
+        }
+        return keys.size();
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of worker threads for data parallel loops.
+ * parallel_for hands out task indices through a shared atomic counter, so
+ * idle workers keep taking tasks off the remaining range until it is
+ * empty. The calling thread works as worker 0 and parallel_for returns
+ * once every task is done.
+ */
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(size_t, size_t)> task;
+    size_t num_tasks;
+    std::atomic<size_t> next_task;
+    size_t generation;
+    size_t running;
+    bool stopping;
+
+    void run(size_t const worker) {
+        for (size_t i = next_task++; i < num_tasks; i = next_task++) {
+            task(i, worker);
+        }
+    }
+
+    void work(size_t const worker) {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen]() {
+                    return stopping || generation != seen;
+                });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+            }
+            run(worker);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+public:
+    /*
+     * num_threads includes the calling thread, 0 uses one thread per core.
+     */
+    explicit ThreadPool(size_t num_threads = 0)
+    : num_tasks(0), next_task(0), generation(0), running(0), stopping(false) {
+        if (num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 1; i < num_threads; i++) {
+            workers.emplace_back(&ThreadPool::work, this, i);
+        }
+    }
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator =(ThreadPool const&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    /*
+     * Calls f(i, worker) for every i in [0, num), where worker < size()
+     * identifies the calling thread, e.g. to index per thread buffers.
+     * Must not be called from inside f.
+     */
+    template <class Function>
+    void parallel_for(size_t const num, Function f) {
+        if (num == 0) {
+            return;
+        }
+        if (workers.empty() || num == 1) {
+            for (size_t i = 0; i < num; i++) {
+                f(i, 0);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = f;
+            num_tasks = num;
+            next_task = 0;
+            running = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        run(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() {
+            return running == 0;
+        });
+        task = nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include <vector>
+#include <gtest/gtest.h>
+#include "adj_list.h"
+
+typedef AdjacencyList<int, int> TestingAdjList;
+typedef TestingAdjList::FrozenList TestingCSR;
+typedef TestingAdjList::AdjacencyTree AdjacencyTree;
+typedef TestingAdjList::ValueTree ValueTree;
+
+class AdjacencyCSRTest
+: public ::testing::Test {
+public:
+    TestingAdjList adj;
+    TestingCSR csr;
+
+    virtual void SetUp() {
+        AdjacencyTree edges;
+        edges.insert(1, {1, 2});
+        edges.insert(1, {1, 3});
+        edges.insert(1, {1, 4});
+        edges.insert(2, {2, 5});
+        edges.insert(3, {3, 6});
+        edges.insert(4, {4, 7});
+        ValueTree values;
+        for (int i=1; i<=8; i++) {
+            values.insert(i, i);
+        }
+        adj = TestingAdjList(values, edges);
+        csr = adj.freeze();
+    }
+};
+
+TEST_F(AdjacencyCSRTest, Exists) {
+    EXPECT_EQ(8, csr.size());
+    for (int i=1; i<=8; i++) {
+        EXPECT_TRUE(csr.exists(i, 0));
+    }
+    EXPECT_FALSE(csr.exists(0, 0));
+    EXPECT_FALSE(csr.exists(9, 0));
+}
+
+TEST_F(AdjacencyCSRTest, Children) {
+    EXPECT_EQ(adj.children(1, 0), csr.children(1, 0));
+    EXPECT_EQ(std::vector<int>({5}), csr.children(2, 0));
+    EXPECT_TRUE(csr.children(5, 0).empty());
+    EXPECT_TRUE(csr.children(8, 0).empty());
+    EXPECT_EQ(3, csr.num_childs(1, 0));
+    EXPECT_EQ(0, csr.num_childs(7, 0));
+    EXPECT_THROW(csr.children(9, 0), hierarchy_key_not_found);
+
+    size_t id;
+    ASSERT_TRUE(csr.find(1, id));
+    std::vector<int> descendants;
+    csr.for_each_descendant(id, [&](size_t d) {
+        descendants.push_back(csr.key(d));
+    });
+    EXPECT_EQ(std::vector<int>({4, 7, 3, 6, 2, 5}), descendants);
+}
+
+TEST_F(AdjacencyCSRTest, IsAncestor) {
+    EXPECT_TRUE(csr.is_ancestor(1, 2, 0));
+    EXPECT_TRUE(csr.is_ancestor(1, 5, 0));
+    EXPECT_TRUE(csr.is_ancestor(4, 7, 0));
+    EXPECT_FALSE(csr.is_ancestor(1, 1, 0));
+    EXPECT_FALSE(csr.is_ancestor(2, 6, 0));
+    EXPECT_FALSE(csr.is_ancestor(1, 8, 0));
+    EXPECT_FALSE(csr.is_ancestor(8, 1, 0));
+    EXPECT_THROW(csr.is_ancestor(1, 9, 0), hierarchy_key_not_found);
+}
+
+TEST_F(AdjacencyCSRTest, Lca) {
+    EXPECT_EQ(1, csr.lca(5, 6, 0));
+    EXPECT_EQ(2, csr.lca(5, 2, 0));
+    EXPECT_EQ(7, csr.lca(7, 7, 0));
+    EXPECT_THROW(csr.lca(8, 1, 0), hierarchy_no_common_ancestor);
+}
+
+TEST_F(AdjacencyCSRTest, Versions) {
+    adj.remove(5);
+    adj.insert(8, 9, 9);
+    adj.commit();
+    TestingCSR latest = adj.freeze();
+    EXPECT_FALSE(latest.exists(5, 0));
+    EXPECT_TRUE(latest.is_ancestor(8, 9, 0));
+    EXPECT_TRUE(adj.freeze(0).exists(5, 0));
+    EXPECT_FALSE(adj.freeze(0).exists(9, 0));
+    EXPECT_THROW(latest.insert(1, 10, 10), csr_read_only);
+    EXPECT_THROW(latest.remove(9), csr_read_only);
+}
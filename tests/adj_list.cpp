@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <gtest/gtest.h>
+#include "adj_list.h"
+
+typedef AdjacencyList<int, int> TestingAdjList;
+typedef TestingAdjList::AdjacencyTree AdjacencyTree;
+typedef TestingAdjList::ValueTree ValueTree;
+
+class AdjacencyListTest
+: public ::testing::Test {
+public:
+    TestingAdjList adj;
+
+    virtual void SetUp() {
+        AdjacencyTree edges;
+        edges.insert(1, {1, 2});
+        edges.insert(1, {1, 3});
+        edges.insert(1, {1, 4});
+        edges.insert(2, {2, 5});
+        edges.insert(3, {3, 6});
+        edges.insert(4, {4, 7});
+        ValueTree values;
+        for (int i=1; i<=8; i++) {
+            values.insert(i, i);
+        }
+        adj = TestingAdjList(values, edges);
+    }
+};
+
+TEST_F(AdjacencyListTest, Lca) {
+    EXPECT_EQ(1, adj.lca(5, 6, 0));
+    EXPECT_EQ(1, adj.lca(2, 7, 0));
+    EXPECT_EQ(2, adj.lca(2, 5, 0));
+    EXPECT_EQ(2, adj.lca(5, 2, 0));
+    EXPECT_EQ(1, adj.lca(1, 7, 0));
+    EXPECT_EQ(6, adj.lca(6, 6, 0));
+
+    // 8 has no edges and is a root of its own
+    EXPECT_EQ(8, adj.lca(8, 8, 0));
+    EXPECT_THROW(adj.lca(8, 1, 0), hierarchy_no_common_ancestor);
+    EXPECT_THROW(adj.lca(9, 1, 0), hierarchy_key_not_found);
+}
+
+TEST_F(AdjacencyListTest, IsAncestor) {
+    for (bool bidirectional : {false, true}) {
+        auto is_ancestor = [this, bidirectional](int parent, int child) {
+            return bidirectional ? adj.is_ancestor_bidirectional(parent, child)
+                : adj.is_ancestor(parent, child, 0);
+        };
+        EXPECT_TRUE(is_ancestor(1, 2));
+        EXPECT_TRUE(is_ancestor(1, 5));
+        EXPECT_TRUE(is_ancestor(2, 5));
+        EXPECT_TRUE(is_ancestor(4, 7));
+
+        EXPECT_FALSE(is_ancestor(1, 1));
+        EXPECT_FALSE(is_ancestor(2, 1));
+        EXPECT_FALSE(is_ancestor(2, 6));
+        EXPECT_FALSE(is_ancestor(3, 7));
+        EXPECT_FALSE(is_ancestor(8, 7));
+        EXPECT_FALSE(is_ancestor(1, 8));
+
+        EXPECT_THROW(is_ancestor(1, 9), hierarchy_key_not_found);
+    }
+}
+
+TEST(AdjacencyListDeepTest, Lca) {
+    // two chains of different length below a long common chain
+    int const depth = 1000;
+    AdjacencyTree edges;
+    ValueTree values;
+    values.insert(0, 0);
+    for (int i = 1; i < depth; i++) {
+        edges.insert(i - 1, {i - 1, i});
+        values.insert(i, i);
+    }
+    int left = depth - 1;
+    int right = depth - 1;
+    for (int i = 0; i < 300; i++) {
+        edges.insert(left, {left, 10000 + i});
+        values.insert(10000 + i, 10000 + i);
+        left = 10000 + i;
+    }
+    for (int i = 0; i < 77; i++) {
+        edges.insert(right, {right, 20000 + i});
+        values.insert(20000 + i, 20000 + i);
+        right = 20000 + i;
+    }
+    TestingAdjList adj(values, edges);
+
+    EXPECT_EQ(depth - 1, adj.lca(left, right, 0));
+    EXPECT_EQ(depth - 1, adj.lca(right, left, 0));
+    EXPECT_EQ(10100, adj.lca(10100, left, 0));
+    for (int i = 0; i < depth; i += 37) {
+        EXPECT_EQ(i, adj.lca(i, left, 0));
+        EXPECT_EQ(i, adj.lca(right, i, 0));
+    }
+}
+
+TEST(AdjacencyListDeepTest, IsAncestor) {
+    // a long chain with a wide level of leaves at its end
+    int const depth = 1000;
+    int const width = 1000;
+    AdjacencyTree edges;
+    ValueTree values;
+    values.insert(0, 0);
+    for (int i = 1; i < depth; i++) {
+        edges.insert(i - 1, {i - 1, i});
+        values.insert(i, i);
+    }
+    for (int i = 0; i < width; i++) {
+        edges.insert(depth - 1, {depth - 1, 10000 + i});
+        values.insert(10000 + i, 10000 + i);
+    }
+    TestingAdjList adj(values, edges);
+
+    for (int i = 0; i < depth - 1; i += 37) {
+        EXPECT_TRUE(adj.is_ancestor(i, 10000 + i, 0));
+        EXPECT_TRUE(adj.is_ancestor_bidirectional(i, 10000 + i));
+        EXPECT_TRUE(adj.is_ancestor(i, depth - 1, 0));
+        EXPECT_TRUE(adj.is_ancestor_bidirectional(i, depth - 1));
+        EXPECT_FALSE(adj.is_ancestor(10000 + i, i, 0));
+        EXPECT_FALSE(adj.is_ancestor_bidirectional(10000 + i, i));
+    }
+    EXPECT_FALSE(adj.is_ancestor_bidirectional(10000, 10001));
+}
+
+TEST_F(AdjacencyListTest, InsertRemove) {
+    EXPECT_THROW(adj.insert(9, 10, 10), hierarchy_key_not_found);
+    EXPECT_THROW(adj.insert(1, 2, 2), adj_key_exists);
+    EXPECT_THROW(adj.remove(9), hierarchy_key_not_found);
+    EXPECT_THROW(adj.remove(2), adj_key_has_children);
+
+    adj.insert(5, 9, 9);
+    adj.remove(6);
+    // pending changes are only seen by queries without a version
+    EXPECT_TRUE(adj.exists(9));
+    EXPECT_FALSE(adj.exists(6));
+    EXPECT_TRUE(adj.is_ancestor(2, 9));
+    EXPECT_TRUE(adj.exists(6, 0));
+    EXPECT_THROW(adj.exists(9, 1), adj_invalid_version);
+
+    EXPECT_EQ(1, adj.commit());
+    EXPECT_EQ(1, adj.commit());
+    EXPECT_TRUE(adj.exists(9, 1));
+    EXPECT_FALSE(adj.exists(9, 0));
+    EXPECT_FALSE(adj.exists(6, 1));
+    EXPECT_TRUE(adj.exists(6, 0));
+    EXPECT_EQ(std::vector<int>({9}), adj.children(5, 1));
+    EXPECT_TRUE(adj.children(5, 0).empty());
+    EXPECT_EQ(0, adj.num_childs(3, 1));
+    EXPECT_EQ(1, adj.num_childs(3, 0));
+    EXPECT_TRUE(adj.is_ancestor(1, 9, 1));
+    EXPECT_EQ(5, adj.lca(9, 5, 1));
+    EXPECT_EQ(1, adj.lca(9, 7, 1));
+    EXPECT_THROW(adj.lca(9, 5, 0), hierarchy_key_not_found);
+
+    // a removed key can be inserted again somewhere else
+    adj.insert(7, 6, 60);
+    EXPECT_EQ(2, adj.commit());
+    EXPECT_TRUE(adj.is_ancestor(3, 6, 0));
+    EXPECT_FALSE(adj.exists(6, 1));
+    EXPECT_TRUE(adj.is_ancestor(4, 6, 2));
+    EXPECT_FALSE(adj.is_ancestor(3, 6, 2));
+    EXPECT_EQ(60, adj.search(6));
+}
+
+TEST_F(AdjacencyListTest, CollectGarbage) {
+    adj.remove(5);
+    adj.commit();
+    adj.remove(2);
+    adj.commit();
+    adj.insert(1, 10, 10);
+    adj.commit();
+
+    std::vector<int> children = adj.children(1, 3);
+    EXPECT_EQ(0, adj.collect_garbage(0));
+    // version 2 only drops the entries removed by versions 1 and 2
+    EXPECT_EQ(4, adj.collect_garbage(2));
+    EXPECT_EQ(2, adj.min_version());
+    EXPECT_THROW(adj.exists(1, 1), adj_invalid_version);
+    EXPECT_FALSE(adj.exists(5, 2));
+    EXPECT_THROW(adj.search(5), hierarchy_key_not_found);
+    EXPECT_EQ(std::vector<int>({4, 3}), adj.children(1, 2));
+    EXPECT_EQ(children, adj.children(1, 3));
+    EXPECT_TRUE(adj.exists(8, 3));
+}
+
+TEST(AdjacencyListRetainTest, Commit) {
+    ValueTree values;
+    values.insert(0, 0);
+    TestingAdjList adj(values, AdjacencyTree(), 2);
+    for (int i = 1; i <= 100; i++) {
+        adj.insert(0, i, i);
+        adj.commit();
+        adj.remove(i);
+        adj.commit();
+        EXPECT_LE(adj.max_version() - adj.min_version(), 2 * 2 + 2);
+    }
+    EXPECT_TRUE(adj.children(0, adj.max_version()).empty());
+    EXPECT_EQ(std::vector<int>({100}), adj.children(0, adj.max_version() - 1));
+}
+
+TEST_F(AdjacencyListTest, ParallelTraversal) {
+    ThreadPool pool(4);
+    std::vector<int> descendants = adj.descendants(1, 0, pool);
+    std::sort(descendants.begin(), descendants.end());
+    EXPECT_EQ(std::vector<int>({2, 3, 4, 5, 6, 7}), descendants);
+    EXPECT_EQ(6, adj.num_descendants(1, 0, pool));
+    EXPECT_EQ(1, adj.num_descendants(2, 0, pool));
+    EXPECT_EQ(0, adj.num_descendants(8, 0, pool));
+    EXPECT_THROW(adj.num_descendants(9, 0, pool), hierarchy_key_not_found);
+
+    EXPECT_TRUE(adj.is_ancestor(1, 7, 0, pool));
+    EXPECT_FALSE(adj.is_ancestor(2, 7, 0, pool));
+    EXPECT_FALSE(adj.is_ancestor(7, 1, 0, pool));
+
+    adj.remove(7);
+    adj.commit();
+    EXPECT_EQ(5, adj.num_descendants(1, 1, pool));
+    EXPECT_EQ(6, adj.num_descendants(1, 0, pool));
+}
+
+TEST(AdjacencyListWideTest, ParallelTraversal) {
+    // three levels with a fanout of 50 below the root
+    AdjacencyTree edges;
+    ValueTree values;
+    values.insert(0, 0);
+    std::vector<int> level(1, 0);
+    int next = 1;
+    for (int depth = 0; depth < 3; depth++) {
+        std::vector<int> next_level;
+        for (int parent : level) {
+            for (int i = 0; i < 50; i++) {
+                edges.insert(parent, {parent, next});
+                values.insert(next, next);
+                next_level.push_back(next++);
+            }
+        }
+        level.swap(next_level);
+    }
+    TestingAdjList adj(values, edges);
+
+    ThreadPool pool(8);
+    EXPECT_EQ(next - 1, adj.num_descendants(0, 0, pool));
+    std::vector<int> descendants = adj.descendants(0, 0, pool);
+    std::sort(descendants.begin(), descendants.end());
+    ASSERT_EQ(next - 1, descendants.size());
+    for (int i = 0; i < next - 1; i++) {
+        EXPECT_EQ(i + 1, descendants[i]);
+    }
+    EXPECT_EQ(50 * 50 + 50, adj.num_descendants(1, 0, pool));
+    EXPECT_TRUE(adj.is_ancestor(0, next - 1, 0, pool));
+    EXPECT_TRUE(adj.is_ancestor(50, next - 1, 0, pool));
+    EXPECT_FALSE(adj.is_ancestor(1, next - 1, 0, pool));
+}
+
+TEST_F(AdjacencyListTest, KthAncestor) {
+    EXPECT_EQ(0, adj.depth(1, 0));
+    EXPECT_EQ(2, adj.depth(7, 0));
+    EXPECT_EQ(0, adj.depth(8, 0));
+    EXPECT_EQ(7, adj.kth_ancestor(7, 0, 0));
+    EXPECT_EQ(4, adj.kth_ancestor(7, 1, 0));
+    EXPECT_EQ(1, adj.kth_ancestor(7, 2, 0));
+    EXPECT_THROW(adj.kth_ancestor(7, 3, 0), adj_no_ancestor);
+    EXPECT_THROW(adj.depth(9, 0), hierarchy_key_not_found);
+}
+
+TEST(AdjacencyListDeepTest, KthAncestor) {
+    // a chain built by inserting leaves, so the jump pointers are only
+    // maintained incrementally
+    int const depth = 50000;
+    ValueTree values;
+    values.insert(0, 0);
+    TestingAdjList adj(values, AdjacencyTree());
+    for (int i = 1; i < depth; i++) {
+        adj.insert(i - 1, i, i);
+    }
+    adj.insert(depth / 2, -1, -1);
+    adj.commit();
+
+    EXPECT_EQ(depth - 1, adj.depth(depth - 1));
+    EXPECT_EQ(depth / 2 + 1, adj.depth(-1, 1));
+    for (int k = 0; k < depth; k += 997) {
+        EXPECT_EQ(depth - 1 - k, adj.kth_ancestor(depth - 1, k));
+    }
+    EXPECT_EQ(0, adj.kth_ancestor(depth - 1, depth - 1));
+    EXPECT_EQ(depth / 2, adj.kth_ancestor(-1, 1));
+    EXPECT_EQ(depth / 2, adj.lca(-1, depth - 1));
+    EXPECT_TRUE(adj.is_ancestor(1, depth - 1, 1));
+    EXPECT_FALSE(adj.is_ancestor(depth / 2 + 1, -1, 1));
+}
+
+TEST_F(AdjacencyListTest, ChildrenBuffer) {
+    std::vector<int> buffer(10, -1);
+    adj.children(1, 0, buffer);
+    EXPECT_EQ(adj.children(1, 0), buffer);
+    adj.children(7, 0, buffer);
+    EXPECT_TRUE(buffer.empty());
+
+    adj.insert(1, 9, 9);
+    adj.remove(6);
+    adj.children(1, buffer);
+    EXPECT_EQ(4, buffer.size());
+    adj.children(1, 0, buffer);
+    EXPECT_EQ(3, buffer.size());
+
+    std::vector<int> range;
+    for (int child : adj.child_range(1)) {
+        range.push_back(child);
+    }
+    EXPECT_EQ(adj.children(1), range);
+    range.clear();
+    for (int child : adj.child_range(1, 0)) {
+        range.push_back(child);
+    }
+    EXPECT_EQ(adj.children(1, 0), range);
+    EXPECT_TRUE(adj.child_range(5, 0).begin() == adj.child_range(5, 0).end());
+    EXPECT_THROW(adj.child_range(9, 0), hierarchy_key_not_found);
+}
@@ -0,0 +1,791 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <malloc.h>
+
+#include "adj_list.h"
+#include "delta_log.h"
+#include "deltani.h"
+#include "nested_intervals.h"
+#include "ni_convert.h"
+
+typedef uint32_t Key;
+typedef AdjacencyList<Key, Key> BenchAdjList;
+typedef NestedIntervals<Key, Key> BenchNI;
+typedef DeltaNI<Key, Key> BenchDeltaNI;
+typedef BenchAdjList::FrozenList BenchCSR;
+typedef BenchAdjList::AdjacencyTree AdjacencyTree;
+typedef BenchNI::NIEdgeTree NIEdgeTree;
+typedef BenchNI::ValueTree ValueTree;
+typedef BenchDeltaNI::DeltaFunction DeltaFunction;
+typedef BenchDeltaNI::DeltaRange DeltaRange;
+typedef BenchDeltaNI::NIEdge NIEdge;
+
+
+struct BenchTree {
+    ValueTree values;
+    AdjacencyTree adj_edges;
+    NIEdgeTree ni_edges;
+    size_t num_nodes;
+};
+
+/*
+ * Builds a tree with root 0 and chains of the given depth hanging from it,
+ * about num_nodes keys in total.
+ */
+void make_tree(size_t const depth, size_t const num_nodes, BenchTree& tree) {
+    size_t const branches = std::max<size_t>(1, num_nodes / depth);
+    tree.values.insert(0, 0);
+    Key next = 1;
+    for (size_t b = 0; b < branches; b++) {
+        Key parent = 0;
+        for (size_t d = 0; d < depth; d++) {
+            Key key = next++;
+            tree.adj_edges.insert(parent, {parent, key});
+            tree.values.insert(key, key);
+            parent = key;
+        }
+    }
+    tree.num_nodes = next;
+
+    NIConverter<Key>(tree.adj_edges, 1).convert(tree.ni_edges);
+}
+
+/*
+ * Delta function backed by two B+-trees, the representation DeltaNI used
+ * before the flat arrays. Only kept as a baseline.
+ */
+class TreeDeltaFunction {
+private:
+    BPTree<DeltaRange, uint64_t> ranges;
+    BPTree<DeltaRange, uint64_t> ranges_inv;
+
+public:
+    explicit TreeDeltaFunction(DeltaFunction const& delta) {
+        delta.for_each_range([this](DeltaRange const& range) {
+            ranges.insert(range.from, range);
+            ranges_inv.insert(range.to, range);
+        });
+    }
+
+    uint64_t evaluate(uint64_t const value) const {
+        DeltaRange const& range = *ranges.search_range(value).begin();
+        return value + range.to - range.from;
+    }
+
+    uint64_t evaluate_inv(uint64_t const value) const {
+        DeltaRange const& range = *ranges_inv.search_range(value).begin();
+        return value - range.to + range.from;
+    }
+
+    NIEdge apply(NIEdge const& edge) const {
+        return {edge.key, NIBound(evaluate(edge.lower)), NIBound(evaluate(edge.upper))};
+    }
+};
+
+/*
+ * Merges num_inserts deltas like DeltaNI::insert creates them for a label
+ * space of max_label labels.
+ */
+DeltaFunction make_delta(size_t const num_inserts, uint64_t max_label, std::mt19937& gen) {
+    DeltaFunction merged;
+    for (size_t i = 0; i < num_inserts; i++) {
+        uint64_t parent_upper = std::uniform_int_distribution<uint64_t>(2, max_label)(gen);
+        DeltaFunction delta;
+        delta.add_range({1, 1});
+        delta.add_range({parent_upper, parent_upper + 2});
+        delta.add_range({max_label + 1, parent_upper});
+        delta.add_range({max_label + 3, max_label + 3});
+        max_label += 2;
+        delta.max = max_label;
+        merged = merged.merge(delta);
+    }
+    return merged;
+}
+
+template <class Function>
+double measure(size_t const repetitions, Function f) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < repetitions; i++) {
+        f(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / repetitions;
+}
+
+void bench_lca() {
+    size_t const num_nodes = 20000;
+    size_t const num_queries = 2000;
+    size_t const num_versions = 64;
+
+    std::cout << "lca, " << num_nodes << " nodes, us per query" << std::endl;
+    std::cout << "depth\tadj\tni\tdeltani\tdeltani_cp\tdeltani_cache" << std::endl;
+    for (size_t depth : {10, 100, 1000, 10000}) {
+        BenchTree tree;
+        make_tree(depth, num_nodes, tree);
+        BenchAdjList adj(tree.values, tree.adj_edges);
+        BenchNI ni(tree.values, tree.ni_edges);
+        BenchDeltaNI deltani(tree.values, tree.ni_edges);
+        // give the delta pyramid some history
+        for (size_t v = 0; v < num_versions; v++) {
+            Key key = tree.num_nodes + v;
+            deltani.insert(v % tree.num_nodes, key, key);
+            deltani.commit();
+        }
+        BenchDeltaNI checkpointed = deltani;
+        checkpointed.checkpoint(num_versions);
+        BenchDeltaNI cached = deltani;
+        cached.set_version_cache(static_cast<size_t>(1) << 30);
+        cached.cache_version(num_versions);
+
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        std::vector<std::pair<Key, Key>> queries;
+        for (size_t i = 0; i < num_queries; i++) {
+            queries.push_back({dist(gen), dist(gen)});
+        }
+
+        Key sum = 0;
+        double adj_time = measure(num_queries, [&](size_t i) {
+            sum += adj.lca(queries[i].first, queries[i].second, 0);
+        });
+        double ni_time = measure(num_queries, [&](size_t i) {
+            sum += ni.lca(queries[i].first, queries[i].second, 0);
+        });
+        double deltani_time = measure(num_queries, [&](size_t i) {
+            sum += deltani.lca(queries[i].first, queries[i].second, num_versions);
+        });
+        double checkpointed_time = measure(num_queries, [&](size_t i) {
+            sum += checkpointed.lca(queries[i].first, queries[i].second, num_versions);
+        });
+        double cached_time = measure(num_queries, [&](size_t i) {
+            sum += cached.lca(queries[i].first, queries[i].second, num_versions);
+        });
+        std::cout << depth << "\t" << adj_time << "\t" << ni_time << "\t" << deltani_time << "\t"
+            << checkpointed_time << "\t" << cached_time << "\t(" << sum << ")" << std::endl;
+    }
+}
+
+void bench_is_ancestor() {
+    size_t const num_nodes = 20000;
+    size_t const num_queries = 2000;
+
+    std::cout << "is_ancestor, " << num_nodes << " nodes, us per query" << std::endl;
+    std::cout << "depth\tadj\tadj_bidir\tni" << std::endl;
+    for (size_t depth : {10, 100, 1000, 10000}) {
+        BenchTree tree;
+        make_tree(depth, num_nodes, tree);
+        BenchAdjList adj(tree.values, tree.adj_edges);
+        BenchNI ni(tree.values, tree.ni_edges);
+
+        // half of the queries ask for the root, like "is this under World?"
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        std::vector<std::pair<Key, Key>> queries;
+        for (size_t i = 0; i < num_queries; i++) {
+            queries.push_back({i % 2 == 0 ? 0 : dist(gen), dist(gen)});
+        }
+
+        size_t sum = 0;
+        double adj_time = measure(num_queries, [&](size_t i) {
+            sum += adj.is_ancestor(queries[i].first, queries[i].second, 0);
+        });
+        double bidir_time = measure(num_queries, [&](size_t i) {
+            sum += adj.is_ancestor_bidirectional(queries[i].first, queries[i].second);
+        });
+        double ni_time = measure(num_queries, [&](size_t i) {
+            sum += ni.is_ancestor(queries[i].first, queries[i].second, 0);
+        });
+        std::cout << depth << "\t" << adj_time << "\t" << bidir_time << "\t"
+            << ni_time << "\t(" << sum << ")" << std::endl;
+    }
+}
+
+void bench_kth_ancestor() {
+    size_t const num_queries = 2000;
+
+    std::cout << "kth_ancestor on a chain, us per query" << std::endl;
+    std::cout << "depth\tjump\tparent walk (csr)" << std::endl;
+    for (size_t depth : {100, 5000, 50000}) {
+        BenchTree tree;
+        make_tree(depth, depth, tree);
+        BenchAdjList adj(tree.values, tree.adj_edges);
+        BenchCSR csr = adj.freeze();
+        Key const leaf = tree.num_nodes - 1;
+        size_t leaf_id = 0;
+        csr.find(leaf, leaf_id);
+
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<size_t> dist(0, depth);
+        std::vector<size_t> queries;
+        for (size_t i = 0; i < num_queries; i++) {
+            queries.push_back(dist(gen));
+        }
+
+        size_t sum = 0;
+        double jump_time = measure(num_queries, [&](size_t i) {
+            sum += adj.kth_ancestor(leaf, queries[i], 0);
+        });
+        double walk_time = measure(num_queries, [&](size_t i) {
+            size_t id = leaf_id;
+            for (size_t k = 0; k < queries[i]; k++) {
+                id = csr.parent(id);
+            }
+            sum += csr.key(id);
+        });
+        std::cout << depth << "\t" << jump_time << "\t" << walk_time << "\t(" << sum << ")" << std::endl;
+    }
+}
+
+void bench_children() {
+    size_t const num_nodes = 200000;
+    size_t const num_queries = 20000;
+
+    std::cout << "children, " << num_nodes << " nodes, us per query" << std::endl;
+    std::cout << "depth\tadj\tadj_buf\tadj_range\tcsr\tcsr_buf\tadj_num\tcsr_num\tdeltani" << std::endl;
+    for (size_t depth : {2, 10, 1000}) {
+        BenchTree tree;
+        make_tree(depth, num_nodes, tree);
+        BenchAdjList adj(tree.values, tree.adj_edges);
+        BenchCSR csr = adj.freeze();
+        BenchDeltaNI deltani(tree.values, tree.ni_edges);
+
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        std::vector<Key> queries;
+        for (size_t i = 0; i < num_queries; i++) {
+            // every tenth query asks for the root with all chains below it
+            queries.push_back(i % 10 == 0 ? 0 : dist(gen));
+        }
+
+        size_t sum = 0;
+        double adj_time = measure(num_queries, [&](size_t i) {
+            sum += adj.children(queries[i], 0).size();
+        });
+        std::vector<Key> buffer;
+        double adj_buffer_time = measure(num_queries, [&](size_t i) {
+            adj.children(queries[i], 0, buffer);
+            sum += buffer.size();
+        });
+        double adj_range_time = measure(num_queries, [&](size_t i) {
+            for (Key child : adj.child_range(queries[i], 0)) {
+                sum += child != 0;
+            }
+        });
+        double csr_time = measure(num_queries, [&](size_t i) {
+            sum += csr.children(queries[i], 0).size();
+        });
+        double csr_buffer_time = measure(num_queries, [&](size_t i) {
+            csr.children(queries[i], 0, buffer);
+            sum += buffer.size();
+        });
+        double adj_num_time = measure(num_queries, [&](size_t i) {
+            sum += adj.num_childs(queries[i], 0);
+        });
+        double csr_num_time = measure(num_queries, [&](size_t i) {
+            sum += csr.num_childs(queries[i], 0);
+        });
+        double deltani_time = measure(num_queries, [&](size_t i) {
+            deltani.children(queries[i], 0, buffer);
+            sum += buffer.size();
+        });
+        std::cout << depth << "\t" << adj_time << "\t" << adj_buffer_time << "\t" << adj_range_time
+            << "\t" << csr_time << "\t" << csr_buffer_time << "\t" << adj_num_time
+            << "\t" << csr_num_time << "\t" << deltani_time << "\t(" << sum << ")" << std::endl;
+    }
+}
+
+void bench_descendants() {
+    size_t const num_nodes = 1000000;
+
+    std::cout << "num_descendants of the root, " << num_nodes << " nodes, ms per query" << std::endl;
+    std::cout << "depth\t1\t2\t4\t8 threads" << std::endl;
+    for (size_t depth : {10, 1000}) {
+        BenchTree tree;
+        make_tree(depth, num_nodes, tree);
+        BenchAdjList adj(tree.values, tree.adj_edges);
+        std::cout << depth;
+        for (size_t threads : {1, 2, 4, 8}) {
+            ThreadPool pool(threads);
+            size_t num = 0;
+            double time = measure(3, [&](size_t) {
+                num = adj.num_descendants(0, 0, pool);
+            });
+            std::cout << "\t" << time / 1000;
+        }
+        std::cout << std::endl;
+    }
+}
+
+void bench_delta() {
+    size_t const num_labels = 2000000;
+    size_t const num_queries = 1000000;
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<NIBound> dist(1, num_labels);
+    std::vector<NIBound> labels;
+    for (size_t i = 0; i < num_queries; i++) {
+        labels.push_back(dist(gen));
+    }
+
+    std::cout << "delta functions, ns per call" << std::endl;
+    std::cout << "ranges	tree_eval	flat_eval	tree_inv	flat_inv	tree_apply	flat_apply" << std::endl;
+    uint64_t sum = 0;
+    for (size_t num_inserts : {1, 16, 256, 4096}) {
+        DeltaFunction flat = make_delta(num_inserts, num_labels, gen);
+        TreeDeltaFunction tree(flat);
+        double tree_eval = measure(num_queries, [&](size_t i) {
+            sum += tree.evaluate(labels[i]);
+        });
+        double flat_eval = measure(num_queries, [&](size_t i) {
+            sum += flat.evaluate(labels[i]);
+        });
+        double tree_inv = measure(num_queries, [&](size_t i) {
+            sum += tree.evaluate_inv(labels[i]);
+        });
+        double flat_inv = measure(num_queries, [&](size_t i) {
+            sum += flat.evaluate_inv(labels[i]);
+        });
+        double tree_apply = measure(num_queries, [&](size_t i) {
+            sum += tree.apply({0, labels[i], labels[i] + 1}).upper;
+        });
+        double flat_apply = measure(num_queries, [&](size_t i) {
+            sum += flat.apply({0, labels[i], labels[i] + 1}).upper;
+        });
+        std::cout << flat.size() << "\t" << tree_eval * 1000 << "\t" << flat_eval * 1000
+            << "\t" << tree_inv * 1000 << "\t" << flat_inv * 1000
+            << "\t" << tree_apply * 1000 << "\t" << flat_apply * 1000 << std::endl;
+    }
+
+    // the path get_edge applies for version 2^13 - 1, one delta per level
+    std::vector<DeltaFunction> flat_path;
+    std::vector<TreeDeltaFunction> tree_path;
+    for (size_t level = 13; level-- > 0;) {
+        flat_path.push_back(make_delta(static_cast<size_t>(1) << level, num_labels, gen));
+        tree_path.emplace_back(flat_path.back());
+    }
+    double tree_edge = measure(num_queries, [&](size_t i) {
+        NIEdge edge = {0, labels[i], labels[i] + 1};
+        for (TreeDeltaFunction const& delta : tree_path) {
+            edge = delta.apply(edge);
+        }
+        sum += edge.upper;
+    });
+    double flat_edge = measure(num_queries, [&](size_t i) {
+        NIEdge edge = {0, labels[i], labels[i] + 1};
+        for (DeltaFunction const& delta : flat_path) {
+            edge = delta.apply(edge);
+        }
+        sum += edge.upper;
+    });
+    std::cout << "get_edge over " << flat_path.size() << " levels: tree " << tree_edge * 1000
+        << " flat " << flat_edge * 1000 << "\t(" << sum << ")" << std::endl;
+}
+
+void bench_get_edges() {
+    size_t const num_nodes = 200000;
+    size_t const num_versions = 4095;
+
+    BenchTree tree;
+    make_tree(10, num_nodes, tree);
+    BenchDeltaNI deltani(tree.values, tree.ni_edges);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+    for (size_t v = 0; v < num_versions; v++) {
+        Key key = tree.num_nodes + v;
+        deltani.insert(dist(gen), key, key);
+        deltani.commit();
+    }
+    std::vector<NIEdge> all_edges;
+    for (NIEdge const& edge : tree.ni_edges) {
+        all_edges.push_back(edge);
+    }
+    std::shuffle(all_edges.begin(), all_edges.end(), gen);
+
+    std::cout << "get_edges, " << num_nodes << " nodes, version " << num_versions
+        << ", ns per edge" << std::endl;
+    std::cout << "batch\tsingle\tbatched" << std::endl;
+    for (size_t batch_size : {size_t(16), size_t(256), size_t(4096), size_t(65536), all_edges.size()}) {
+        size_t const num_batches = std::max<size_t>(1, 200000 / batch_size);
+        std::vector<std::vector<NIEdge>> batches;
+        for (size_t b = 0; b < num_batches; b++) {
+            size_t first = (b * batch_size) % (all_edges.size() - batch_size + 1);
+            batches.emplace_back(all_edges.begin() + first, all_edges.begin() + first + batch_size);
+        }
+
+        uint64_t sum = 0;
+        double single_time = measure(num_batches, [&](size_t b) {
+            for (NIEdge const& edge : batches[b]) {
+                sum += deltani.get_edge(edge, num_versions).upper;
+            }
+        });
+        std::vector<NIEdge> out;
+        double batch_time = measure(num_batches, [&](size_t b) {
+            deltani.get_edges(batches[b], num_versions, out);
+            sum += out.back().upper;
+        });
+        std::cout << batch_size << "\t" << single_time * 1000 / batch_size << "\t"
+            << batch_time * 1000 / batch_size << "\t(" << sum << ")" << std::endl;
+    }
+}
+
+void bench_update() {
+    size_t const num_nodes = 200000;
+
+    BenchTree tree;
+    make_tree(10, num_nodes, tree);
+
+    std::cout << "uncommitted inserts into " << num_nodes << " nodes, ms per transaction" << std::endl;
+    std::cout << "inserts\tsingle\tbatch" << std::endl;
+    for (size_t num_inserts : {1000, 4000, 8000}) {
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        std::vector<BenchDeltaNI::Update> updates;
+        for (size_t i = 0; i < num_inserts; i++) {
+            Key key = tree.num_nodes + i;
+            updates.push_back({false, dist(gen), key, key});
+        }
+
+        BenchDeltaNI single(tree.values, tree.ni_edges);
+        double single_time = measure(1, [&](size_t) {
+            for (BenchDeltaNI::Update const& u : updates) {
+                single.insert(u.parent, u.key, u.value);
+            }
+        });
+        BenchDeltaNI batch(tree.values, tree.ni_edges);
+        double batch_time = measure(1, [&](size_t) {
+            batch.update(updates);
+        });
+        std::cout << num_inserts << "\t" << single_time / 1000 << "\t" << batch_time / 1000 << std::endl;
+    }
+}
+
+void bench_recover() {
+    size_t const num_nodes = 200000;
+    std::string const path = "bench_recover.log";
+
+    BenchTree tree;
+    make_tree(10, num_nodes, tree);
+
+    std::cout << "commits of single inserts into " << num_nodes << " nodes" << std::endl;
+    std::cout << "commits\tus/commit logged, group 1\tgroup 1024\tms replay commits\trecover 1\t2\t4 threads" << std::endl;
+    for (size_t num_commits : {1000, 10000, 100000}) {
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        std::vector<Key> parents;
+        for (size_t i = 0; i < num_commits; i++) {
+            parents.push_back(dist(gen));
+        }
+        auto run = [&](BenchDeltaNI& deltani, size_t const num) {
+            for (size_t i = 0; i < num; i++) {
+                Key key = tree.num_nodes + i;
+                deltani.insert(parents[i], key, key);
+                deltani.commit();
+            }
+        };
+
+        std::cout << num_commits;
+        // syncing every commit is slow, only a prefix is measured
+        for (size_t group_size : {1, 1024}) {
+            size_t num = group_size == 1 ? std::min<size_t>(num_commits, 1000) : num_commits;
+            std::remove(path.c_str());
+            BenchDeltaNI logged(tree.values, tree.ni_edges);
+            DeltaLog log(path, group_size);
+            logged.set_log(&log);
+            double time = measure(1, [&](size_t) {
+                run(logged, num);
+            });
+            std::cout << "\t" << time / num;
+        }
+
+        std::remove(path.c_str());
+        {
+            BenchDeltaNI logged(tree.values, tree.ni_edges);
+            DeltaLog log(path, 1024);
+            logged.set_log(&log);
+            run(logged, num_commits);
+        }
+        double replay_time = measure(1, [&](size_t) {
+            BenchDeltaNI replayed(tree.values, tree.ni_edges);
+            run(replayed, num_commits);
+        });
+        std::cout << "\t" << replay_time / 1000;
+        for (size_t threads : {1, 2, 4}) {
+            double time = measure(1, [&](size_t) {
+                BenchDeltaNI recovered(tree.values, tree.ni_edges);
+                recovered.recover(path, threads);
+            });
+            std::cout << "\t" << time / 1000;
+        }
+        std::cout << std::endl;
+    }
+    std::remove(path.c_str());
+}
+
+void bench_diff() {
+    std::cout << "diff over 100 commits, ms per query" << std::endl;
+    std::cout << "nodes\tchanges\tdiff\tscan both versions" << std::endl;
+    for (size_t num_nodes : {20000, 200000, 2000000}) {
+        BenchTree tree;
+        make_tree(10, num_nodes, tree);
+        std::vector<NIEdge> all_edges;
+        for (NIEdge const& e : tree.ni_edges) {
+            all_edges.push_back(e);
+        }
+
+        for (size_t per_commit : {1, 10, 100}) {
+            BenchDeltaNI deltani(tree.values, tree.ni_edges);
+            std::mt19937 gen(42);
+            std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+            Key next = tree.num_nodes;
+            for (size_t c = 0; c < 100; c++) {
+                for (size_t i = 0; i < per_commit; i++) {
+                    deltani.insert(dist(gen), next, next);
+                    next++;
+                }
+                deltani.commit();
+            }
+
+            size_t changes = 0;
+            double diff_time = measure(5, [&](size_t) {
+                changes = deltani.diff(0, 100).size();
+            });
+            std::vector<NIEdge> out1;
+            std::vector<NIEdge> out2;
+            double scan_time = measure(5, [&](size_t) {
+                deltani.get_edges(all_edges, 0, out1);
+                deltani.get_edges(all_edges, 100, out2);
+            });
+            std::cout << num_nodes << "\t" << changes << "\t" << diff_time / 1000 << "\t" << scan_time / 1000 << std::endl;
+        }
+    }
+}
+
+/*
+ * Bytes currently allocated on the heap.
+ */
+double heap_mb() {
+    return mallinfo2().uordblks / (1024.0 * 1024.0);
+}
+
+void bench_truncate() {
+    size_t const num_nodes = 200000;
+    size_t const num_queries = 2000;
+    size_t const kept = 1000;
+
+    BenchTree tree;
+    make_tree(10, num_nodes, tree);
+
+    std::cout << "truncate_before keeping the last " << kept << " commits of single inserts into "
+        << num_nodes << " nodes" << std::endl;
+    std::cout << "commits\theap MB before\tafter\tms truncate\tus/is_ancestor before\tafter" << std::endl;
+    for (size_t num_commits : {10000, 100000, 1000000}) {
+        double heap_base = heap_mb();
+        BenchDeltaNI deltani(tree.values, tree.ni_edges);
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        for (size_t i = 0; i < num_commits; i++) {
+            Key key = tree.num_nodes + i;
+            deltani.insert(dist(gen), key, key);
+            deltani.commit();
+        }
+        std::vector<std::pair<Key, Key>> queries;
+        for (size_t i = 0; i < num_queries; i++) {
+            queries.push_back({dist(gen), dist(gen)});
+        }
+        size_t const version = deltani.max_version() - 1;
+
+        Key sum = 0;
+        double heap_before = heap_mb() - heap_base;
+        double before_time = measure(num_queries, [&](size_t i) {
+            sum += deltani.is_ancestor(queries[i].first, queries[i].second, version);
+        });
+        double truncate_time = measure(1, [&](size_t) {
+            deltani.truncate_before(num_commits - kept);
+        });
+        double heap_after = heap_mb() - heap_base;
+        double after_time = measure(num_queries, [&](size_t i) {
+            sum += deltani.is_ancestor(queries[i].first, queries[i].second, version);
+        });
+        std::cout << num_commits << "\t" << heap_before << "\t" << heap_after << "\t" << truncate_time / 1000
+            << "\t" << before_time << "\t" << after_time << "\t(" << sum << ")" << std::endl;
+    }
+}
+
+void bench_memory() {
+    size_t const num_nodes = 200000;
+
+    BenchTree tree;
+    make_tree(10, num_nodes, tree);
+
+    std::cout << "delta pyramid of single-insert commits into " << num_nodes << " nodes, MB" << std::endl;
+    std::cout << "commits\tlevel 0\tupper levels\theap growth" << std::endl;
+    for (size_t num_commits : {10000, 100000, 1000000}) {
+        BenchDeltaNI deltani(tree.values, tree.ni_edges);
+        double heap_base = heap_mb();
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        for (size_t i = 0; i < num_commits; i++) {
+            Key key = tree.num_nodes + i;
+            deltani.insert(dist(gen), key, key);
+            deltani.commit();
+        }
+        std::vector<size_t> levels = deltani.memory_usage();
+        size_t upper = 0;
+        for (size_t level = 1; level < levels.size(); level++) {
+            upper += levels[level];
+        }
+        double const mb = 1024.0 * 1024.0;
+        std::cout << num_commits << "\t" << levels[0] / mb << "\t" << upper / mb
+            << "\t" << heap_mb() - heap_base << std::endl;
+    }
+}
+
+void bench_compact() {
+    size_t const num_nodes = 200000;
+    size_t const num_queries = 2000;
+
+    BenchTree tree;
+    make_tree(10, num_nodes, tree);
+
+    std::cout << "compact after commits that insert one key and remove an older one, "
+        << num_nodes << " nodes, " << sizeof(NIEdge) << " bytes per edge" << std::endl;
+    std::cout << "commits\tbounds before\tafter\tms compact\tus/is_ancestor before\tafter" << std::endl;
+    for (size_t num_commits : {10000, 100000, 1000000}) {
+        BenchDeltaNI deltani(tree.values, tree.ni_edges);
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        for (size_t i = 0; i < num_commits; i++) {
+            Key key = tree.num_nodes + i;
+            deltani.insert(dist(gen), key, key);
+            if (i >= 1000) {
+                deltani.remove(key - 1000);
+            }
+            deltani.commit();
+        }
+        std::vector<std::pair<Key, Key>> queries;
+        for (size_t i = 0; i < num_queries; i++) {
+            queries.push_back({dist(gen), dist(gen)});
+        }
+
+        Key sum = 0;
+        uint64_t bounds_before = deltani.interval_space();
+        double before_time = measure(num_queries, [&](size_t i) {
+            sum += deltani.is_ancestor(queries[i].first, queries[i].second);
+        });
+        double compact_time = measure(1, [&](size_t) {
+            deltani.compact();
+            deltani.truncate_before(deltani.max_version());
+        });
+        double after_time = measure(num_queries, [&](size_t i) {
+            sum += deltani.is_ancestor(queries[i].first, queries[i].second);
+        });
+        std::cout << num_commits << "\t" << bounds_before << "\t" << deltani.interval_space()
+            << "\t" << compact_time / 1000 << "\t" << before_time << "\t" << after_time
+            << "\t(" << sum << ")" << std::endl;
+    }
+}
+
+void bench_commit() {
+    size_t const num_nodes = 200000;
+    size_t const num_commits = 1 << 17;
+
+    BenchTree tree;
+    make_tree(10, num_nodes, tree);
+
+    std::cout << num_commits << " single-insert commits into " << num_nodes << " nodes, us per commit" << std::endl;
+    std::cout << "merges\tavg\tmax\tms until merged" << std::endl;
+    for (bool background : {false, true}) {
+        BenchDeltaNI deltani(tree.values, tree.ni_edges);
+        deltani.set_background_merges(background);
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> dist(0, tree.num_nodes - 1);
+        double total = 0;
+        double max = 0;
+        for (size_t i = 0; i < num_commits; i++) {
+            Key key = tree.num_nodes + i;
+            deltani.insert(dist(gen), key, key);
+            auto start = std::chrono::steady_clock::now();
+            deltani.commit();
+            std::chrono::duration<double, std::micro> time = std::chrono::steady_clock::now() - start;
+            total += time.count();
+            max = std::max(max, time.count());
+        }
+        double wait_time = measure(1, [&](size_t) {
+            deltani.wait_for_merges();
+        });
+        std::cout << (background ? "background" : "sync") << "\t" << total / num_commits << "\t" << max
+            << "\t" << wait_time / 1000 << std::endl;
+    }
+}
+
+void bench_convert() {
+    size_t const num_nodes = 2000000;
+
+    std::cout << "convert, " << num_nodes << " nodes, ms per conversion" << std::endl;
+    std::cout << "depth\t1\t2\t4\t8 threads" << std::endl;
+    for (size_t depth : {10, 1000, 100000}) {
+        BenchTree tree;
+        make_tree(depth, num_nodes, tree);
+        std::cout << depth;
+        for (size_t threads : {1, 2, 4, 8}) {
+            double time = measure(1, [&](size_t) {
+                NIEdgeTree edges;
+                NIConverter<Key>(tree.adj_edges, threads).convert(edges);
+            });
+            std::cout << "\t" << time / 1000;
+        }
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string const benchmarks = "lca|is_ancestor|kth_ancestor|children|descendants|delta|get_edges|update|recover|diff|truncate|memory|commit|compact|convert";
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <" << benchmarks << ">" << std::endl;
+        return 1;
+    }
+    std::string name(argv[1]);
+    if (name == "lca") {
+        bench_lca();
+    } else if (name == "is_ancestor") {
+        bench_is_ancestor();
+    } else if (name == "kth_ancestor") {
+        bench_kth_ancestor();
+    } else if (name == "children") {
+        bench_children();
+    } else if (name == "descendants") {
+        bench_descendants();
+    } else if (name == "delta") {
+        bench_delta();
+    } else if (name == "get_edges") {
+        bench_get_edges();
+    } else if (name == "update") {
+        bench_update();
+    } else if (name == "recover") {
+        bench_recover();
+    } else if (name == "diff") {
+        bench_diff();
+    } else if (name == "truncate") {
+        bench_truncate();
+    } else if (name == "memory") {
+        bench_memory();
+    } else if (name == "commit") {
+        bench_commit();
+    } else if (name == "compact") {
+        bench_compact();
+    } else if (name == "convert") {
+        bench_convert();
+    } else {
+        std::cerr << "unknown benchmark '" << name << "', try one of " << benchmarks << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -121,6 +121,17 @@ TYPED_TEST(BPTreeTest, EmptySearchTest) {
 
     typename TestFixture::TestTree empty_tree;
     EXPECT_TRUE(empty_tree.search_range(0).empty());
+    EXPECT_TRUE(empty_tree.begin() == empty_tree.end());
+}
+
+TYPED_TEST(BPTreeTest, IteratorKeyTest) {
+    typename TestFixture::KeyType last = 0;
+    for (auto it = this->tree.begin(); it != this->tree.end(); ++it) {
+        EXPECT_LE(last, it.key());
+        EXPECT_EQ(it.key(), *it);
+        last = it.key();
+    }
+    EXPECT_EQ(TEST_MAX_KEY, last);
 }
 
 TYPED_TEST(BPTreeTest, OutOfRangeTest) {
@@ -1,5 +1,13 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
 #include <gtest/gtest.h>
+#include "delta_log.h"
 #include "deltani.h"
 
 typedef DeltaNI<int, int> TestingDeltaNI;
@@ -108,6 +116,63 @@ TEST_F(DeltaFunctionTest, EmptyFunction) {
     }
 }
 
+TEST_F(DeltaFunctionTest, WideRanges) {
+    uint64_t const far = UINT64_C(1) << 40;
+    TestingDeltaFunction wide;
+    wide.add_range({1, 1});
+    wide.add_range({5, far});
+    wide.add_range({far, 5});
+    wide.add_range({far + 1, far + 1});
+    wide.max = far + 1;
+
+    EXPECT_EQ(4, wide.size());
+    EXPECT_EQ(2 * d.memory_usage(), wide.memory_usage());
+    EXPECT_EQ(4, wide.evaluate(4));
+    EXPECT_EQ(far + 2, wide.evaluate(7));
+    EXPECT_EQ(5, wide.evaluate(far));
+    EXPECT_EQ(far + 1, wide.evaluate(far + 1));
+    EXPECT_EQ(5, wide.evaluate_inv(far));
+    EXPECT_EQ(far + 1, wide.evaluate_inv(6));
+
+    // narrow offsets are signed
+    EXPECT_EQ(7, d.evaluate(5));
+    EXPECT_EQ(5, d.evaluate(6));
+    EXPECT_EQ(6, d.evaluate_inv(5));
+
+    TestingDeltaFunction merged = d.merge(wide);
+    for (uint64_t i = 1; i <= 12; i++) {
+        EXPECT_EQ(wide.evaluate(d.evaluate(i)), merged.evaluate(i));
+    }
+    EXPECT_EQ(0, TestingDeltaFunction().memory_usage());
+}
+
+TEST_F(DeltaFunctionTest, MergeMany) {
+    std::vector<TestingDeltaFunction> steps;
+    TestingDeltaFunction merged;
+    uint64_t max = 20;
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t parent_upper = 2 + (i * 7) % (max - 1);
+        TestingDeltaFunction delta;
+        delta.add_range({max + 3, max + 3});
+        delta.add_range({parent_upper, parent_upper + 2});
+        delta.add_range({1, 1});
+        delta.add_range({max + 1, parent_upper});
+        max += 2;
+        delta.max = max;
+        steps.push_back(delta);
+        merged = merged.merge(delta);
+    }
+
+    EXPECT_EQ(max, merged.max);
+    for (uint64_t label = 1; label <= max + 10; label++) {
+        uint64_t expected = label;
+        for (TestingDeltaFunction const& step : steps) {
+            expected = step.evaluate(expected);
+        }
+        EXPECT_EQ(expected, merged.evaluate(label));
+        EXPECT_EQ(label, merged.evaluate_inv(merged.evaluate(label)));
+    }
+}
 
 class DeltaNISanityTest
 : public ::testing::Test {
@@ -700,3 +765,793 @@ TEST_F(DeltaNITest, Commit) {
     EXPECT_TRUE(versions.is_ancestor(3, 7, 5));
     EXPECT_TRUE(versions.is_ancestor(1, 7, 5));
 }
+
+TEST_F(DeltaNITest, Lca) {
+    EXPECT_EQ(4, versions.lca(2, 4, 0));
+    EXPECT_EQ(1, versions.lca(2, 3, 0));
+    EXPECT_EQ(1, versions.lca(4, 3, 0));
+    EXPECT_EQ(3, versions.lca(3, 3, 0));
+
+    // version 1 moved 3 below 4
+    EXPECT_EQ(4, versions.lca(2, 3, 1));
+    EXPECT_EQ(1, versions.lca(1, 3, 1));
+
+    EXPECT_EQ(1, versions.lca(5, 3, 3));
+    EXPECT_EQ(1, versions.lca(5, 4, 3));
+    EXPECT_EQ(4, versions.lca(4, 3, 3));
+
+    EXPECT_EQ(6, versions.lca(6, 5, 4));
+    EXPECT_EQ(1, versions.lca(5, 3, 4));
+    EXPECT_EQ(1, versions.lca(3, 5));
+
+    EXPECT_THROW(versions.lca(2, 3, 2), deltani_key_removed);
+    EXPECT_THROW(versions.lca(100, 3, 2), deltani_invalid_key);
+    EXPECT_THROW(versions.lca(1, 3, 5), deltani_invalid_version);
+
+    versions.insert(3, 7, 7);
+    versions.insert(3, 8, 8);
+    EXPECT_EQ(3, versions.lca(7, 8));
+    EXPECT_EQ(1, versions.lca(7, 6));
+}
+
+TEST_F(DeltaNITest, Children) {
+    typedef std::vector<int> Keys;
+    EXPECT_EQ(Keys({4, 3}), versions.children(1, 0));
+    EXPECT_EQ(Keys({2}), versions.children(4, 0));
+    EXPECT_EQ(Keys(), versions.children(3, 0));
+
+    // version 1 moved 3 below 4
+    EXPECT_EQ(Keys({4}), versions.children(1, 1));
+    EXPECT_EQ(Keys({2, 3}), versions.children(4, 1));
+
+    EXPECT_EQ(Keys({3}), versions.children(4, 2));
+    EXPECT_EQ(Keys({5, 4}), versions.children(1, 3));
+    EXPECT_EQ(Keys({6, 4}), versions.children(1, 4));
+    EXPECT_EQ(Keys({5}), versions.children(6, 4));
+
+    EXPECT_EQ(2, versions.num_childs(1, 0));
+    EXPECT_EQ(1, versions.num_childs(1, 1));
+    EXPECT_EQ(2, versions.num_childs(4, 1));
+    EXPECT_EQ(0, versions.num_childs(5, 4));
+
+    EXPECT_THROW(versions.children(2, 2), deltani_key_removed);
+    EXPECT_THROW(versions.num_childs(100, 0), deltani_invalid_key);
+    EXPECT_THROW(versions.children(1, 5), deltani_invalid_version);
+
+    versions.insert(3, 7, 7);
+    versions.insert(3, 8, 8);
+    versions.remove(5);
+    EXPECT_EQ(Keys({7, 8}), versions.children(3));
+    EXPECT_EQ(Keys(), versions.children(6));
+    EXPECT_EQ(2, versions.num_childs(3));
+    EXPECT_EQ(0, versions.num_childs(3, 4));
+
+    EXPECT_EQ(5, versions.commit());
+    EXPECT_EQ(Keys({7, 8}), versions.children(3, 5));
+    EXPECT_EQ(Keys({6, 4}), versions.children(1, 5));
+    EXPECT_EQ(Keys({5}), versions.children(6, 4));
+}
+
+void expect_same_versions(TestingDeltaNI const& expected, TestingDeltaNI const& actual) {
+    ASSERT_EQ(expected.max_version(), actual.max_version());
+    for (size_t v = 0; v <= expected.max_version(); v++) {
+        for (int a = 1; a <= 8; a++) {
+            ASSERT_EQ(expected.exists(a, v), actual.exists(a, v)) << "version " << v << " key " << a;
+            if (!expected.exists(a, v)) {
+                continue;
+            }
+            EXPECT_EQ(expected.children(a, v), actual.children(a, v)) << "version " << v << " key " << a;
+            for (int b = 1; b <= 8; b++) {
+                if (!expected.exists(b, v)) {
+                    continue;
+                }
+                EXPECT_EQ(expected.is_ancestor(a, b, v), actual.is_ancestor(a, b, v));
+                EXPECT_EQ(expected.lca(a, b, v), actual.lca(a, b, v));
+            }
+        }
+    }
+}
+
+TEST_F(DeltaNITest, Checkpoint) {
+    TestingDeltaNI expected = versions;
+
+    EXPECT_THROW(versions.checkpoint(5), deltani_invalid_version);
+    versions.checkpoint(2);
+    EXPECT_EQ(2, versions.checkpoint_version());
+    expect_same_versions(expected, versions);
+    EXPECT_THROW(versions.checkpoint(1), deltani_invalid_version);
+
+    versions.checkpoint(4);
+    EXPECT_EQ(4, versions.checkpoint_version());
+    expect_same_versions(expected, versions);
+
+    // history after the checkpoint
+    for (TestingDeltaNI* v : {&expected, &versions}) {
+        v->insert(3, 7, 7);
+        v->commit();
+        v->insert(7, 8, 8);
+        v->remove(5);
+        v->commit();
+        v->insert(4, 5, 5);
+        v->commit();
+    }
+    expect_same_versions(expected, versions);
+
+    versions.checkpoint(6);
+    expect_same_versions(expected, versions);
+}
+
+TEST_F(DeltaNITest, BackgroundCheckpoint) {
+    TestingDeltaNI expected = versions;
+
+    TestingDeltaNI::Checkpoint checkpoint;
+    std::thread worker([this, &checkpoint]() {
+        checkpoint = versions.prepare_checkpoint(3);
+    });
+    EXPECT_EQ(1, versions.lca(5, 3, 3));
+    worker.join();
+
+    // a new key inserted after the checkpoint was prepared
+    for (TestingDeltaNI* v : {&expected, &versions}) {
+        v->insert(3, 7, 7);
+        v->commit();
+    }
+    versions.install_checkpoint(checkpoint);
+    EXPECT_EQ(3, versions.checkpoint_version());
+    expect_same_versions(expected, versions);
+    EXPECT_EQ(std::vector<int>({7}), versions.children(3));
+}
+
+TEST_F(DeltaNITest, GetEdges) {
+    std::vector<NIEdge> in = {{1, 1, 8}, {2, 3, 4}, {3, 6, 7}, {4, 2, 5}, {5, 9, 10}, {6, 11, 12}};
+    std::vector<NIEdge> out;
+    versions.insert(3, 7, 7);
+    versions.remove(5);
+
+    for (size_t v = 0; v <= versions.max_version(); v++) {
+        versions.get_edges(in, v, out);
+        ASSERT_EQ(in.size(), out.size());
+        for (size_t i = 0; i < in.size(); i++) {
+            NIEdge expected = versions.get_edge(in[i], v);
+            EXPECT_EQ(expected.key, out[i].key);
+            EXPECT_EQ(expected.lower, out[i].lower);
+            EXPECT_EQ(expected.upper, out[i].upper);
+        }
+    }
+
+    versions.get_edges(in, out);
+    for (size_t i = 0; i < in.size(); i++) {
+        NIEdge expected = versions.get_edge(in[i]);
+        EXPECT_EQ(expected.lower, out[i].lower);
+        EXPECT_EQ(expected.upper, out[i].upper);
+    }
+    EXPECT_THROW(versions.get_edges(in, 5, out), deltani_invalid_version);
+}
+
+TEST_F(DeltaFunctionTest, MergeAll) {
+    TestingDeltaFunction m;
+    m.add_range({1, 1});
+    m.add_range({3, 7});
+    m.add_range({5, 3});
+    m.max = 7;
+
+    std::vector<TestingDeltaFunction> deltas = {d, m, d, m, d};
+    TestingDeltaFunction merged = TestingDeltaFunction::merge_all(deltas);
+    TestingDeltaFunction expected = d.merge(m).merge(d).merge(m).merge(d);
+    EXPECT_EQ(expected.max, merged.max);
+    for (uint64_t i = 1; i <= 10; i++) {
+        EXPECT_EQ(expected.evaluate(i), merged.evaluate(i));
+        EXPECT_EQ(expected.evaluate_inv(i), merged.evaluate_inv(i));
+    }
+    EXPECT_TRUE(TestingDeltaFunction::merge_all({}).empty());
+}
+
+TEST_F(DeltaNITest, Update) {
+    TestingDeltaNI expected = versions;
+    expected.insert(3, 7, 7);
+    expected.insert(7, 8, 8);
+    expected.remove(5);
+    expected.insert(8, 9, 9);
+    expected.remove(9);
+    expected.insert(4, 5, 5);
+
+    versions.update({
+        {false, 3, 7, 7},
+        {false, 7, 8, 8},
+        {true, 5, 5, 0},
+        {false, 8, 9, 9},
+        {true, 9, 9, 0},
+        {false, 4, 5, 5},
+    });
+    EXPECT_EQ(expected.children(1), versions.children(1));
+    EXPECT_EQ(expected.children(4), versions.children(4));
+    EXPECT_EQ(expected.children(7), versions.children(7));
+    EXPECT_EQ(7, versions.search(7));
+    EXPECT_FALSE(versions.exists(9));
+
+    EXPECT_EQ(expected.commit(), versions.commit());
+    expect_same_versions(expected, versions);
+}
+
+TEST_F(DeltaNITest, UpdateIsAtomic) {
+    TestingDeltaNI expected = versions;
+
+    EXPECT_THROW(versions.update({
+        {false, 3, 7, 7},
+        {true, 4, 4, 0},
+    }), deltani_key_has_children);
+    EXPECT_THROW(versions.update({
+        {false, 3, 7, 7},
+        {false, 3, 7, 7},
+    }), deltani_key_exists);
+    EXPECT_THROW(versions.update({
+        {false, 3, 7, 7},
+        {true, 7, 7, 0},
+        {false, 7, 8, 8},
+    }), deltani_key_removed);
+
+    EXPECT_FALSE(versions.exists(7));
+    EXPECT_EQ(expected.children(1), versions.children(1));
+    EXPECT_EQ(expected.commit(), versions.commit());
+    expect_same_versions(expected, versions);
+}
+
+TEST_F(DeltaNITest, LargeUpdate) {
+    TestingDeltaNI expected = versions;
+    std::vector<TestingDeltaNI::Update> updates;
+    for (int key = 7; key < 1000; key++) {
+        int parent = key < 20 || (key / 3) % 5 == 0 ? 1 : key / 3;
+        updates.push_back({false, parent, key, key});
+        expected.insert(parent, key, key);
+        if (key % 5 == 0) {
+            updates.push_back({true, key, key, 0});
+            expected.remove(key);
+        }
+    }
+    versions.update(updates);
+    for (int key = 1; key < 1000; key++) {
+        ASSERT_EQ(expected.exists(key), versions.exists(key));
+        if (expected.exists(key)) {
+            EXPECT_EQ(expected.children(key), versions.children(key));
+        }
+    }
+}
+
+TEST_F(DeltaNITest, MoveSubtree) {
+    typedef std::vector<int> Keys;
+    TestingDeltaNI expected = versions;
+
+    EXPECT_THROW(versions.move_subtree(4, 3), deltani_invalid_move);
+    EXPECT_THROW(versions.move_subtree(4, 4), deltani_invalid_move);
+    EXPECT_THROW(versions.move_subtree(1, 6), deltani_invalid_move);
+    EXPECT_THROW(versions.move_subtree(2, 6), deltani_key_removed);
+    EXPECT_THROW(versions.move_subtree(100, 6), deltani_invalid_key);
+
+    // 6 with child 5 moves right, below 3
+    versions.move_subtree(6, 3);
+    EXPECT_EQ(Keys({4}), versions.children(1));
+    EXPECT_EQ(Keys({6}), versions.children(3));
+    EXPECT_EQ(Keys({5}), versions.children(6));
+    EXPECT_TRUE(versions.is_ancestor(4, 5));
+    EXPECT_EQ(3, versions.lca(5, 3));
+
+    // 3 moves right, behind 4 to the end of 1
+    versions.move_subtree(3, 1);
+    EXPECT_EQ(Keys({4, 3}), versions.children(1));
+    EXPECT_EQ(Keys(), versions.children(4));
+    EXPECT_EQ(Keys({6}), versions.children(3));
+
+    // 6 moves left, below 4
+    versions.move_subtree(6, 4);
+    EXPECT_EQ(Keys({6}), versions.children(4));
+    EXPECT_EQ(Keys(), versions.children(3));
+    EXPECT_EQ(Keys({5}), versions.children(6));
+    EXPECT_EQ(1, versions.lca(5, 3));
+
+    // already the last child
+    versions.move_subtree(3, 1);
+    EXPECT_EQ(Keys({4, 3}), versions.children(1));
+
+    versions.insert(5, 7, 7);
+    EXPECT_EQ(Keys({7}), versions.children(5));
+    EXPECT_TRUE(versions.is_ancestor(4, 7));
+
+    EXPECT_EQ(5, versions.commit());
+    EXPECT_EQ(Keys({4, 3}), versions.children(1, 5));
+    EXPECT_EQ(Keys({6}), versions.children(4, 5));
+    EXPECT_EQ(Keys({5}), versions.children(6, 5));
+    EXPECT_EQ(Keys({7}), versions.children(5, 5));
+    for (size_t v = 0; v <= 4; v++) {
+        for (int key : {1, 3, 4, 6}) {
+            if (expected.exists(key, v)) {
+                EXPECT_EQ(expected.children(key, v), versions.children(key, v));
+            }
+        }
+    }
+}
+
+TEST_F(DeltaNITest, RemoveSubtree) {
+    typedef std::vector<int> Keys;
+    TestingDeltaNI expected = versions;
+
+    versions.insert(3, 7, 7);
+    versions.insert(7, 8, 8);
+    versions.insert(3, 9, 9);
+    EXPECT_THROW(versions.remove_subtree(100), deltani_invalid_key);
+    EXPECT_THROW(versions.remove_subtree(2), deltani_key_removed);
+
+    versions.remove_subtree(4);
+    EXPECT_EQ(Keys({6}), versions.children(1));
+    for (int key : {3, 4, 7, 8, 9}) {
+        EXPECT_FALSE(versions.exists(key));
+        EXPECT_THROW(versions.children(key), deltani_key_removed);
+        EXPECT_FALSE(versions.is_ancestor(1, key));
+    }
+    EXPECT_TRUE(versions.exists(5));
+    EXPECT_TRUE(versions.is_ancestor(6, 5));
+    EXPECT_THROW(versions.remove_subtree(7), deltani_key_removed);
+
+    // keys of a removed subtree come back on their own
+    versions.insert(5, 7, 7);
+    versions.insert(1, 3, 3);
+    EXPECT_EQ(Keys({6, 3}), versions.children(1));
+    EXPECT_EQ(Keys({7}), versions.children(5));
+    EXPECT_EQ(Keys(), versions.children(7));
+    EXPECT_FALSE(versions.exists(8));
+    EXPECT_FALSE(versions.exists(9));
+    versions.insert(7, 8, 8);
+    EXPECT_EQ(Keys({8}), versions.children(7));
+    EXPECT_EQ(1, versions.lca(8, 3));
+
+    EXPECT_EQ(5, versions.commit());
+    EXPECT_FALSE(versions.exists(4, 5));
+    EXPECT_EQ(Keys({6, 3}), versions.children(1, 5));
+    EXPECT_EQ(Keys({3}), versions.children(4, 4));
+    for (size_t v = 0; v <= 4; v++) {
+        for (int key : {1, 3, 4, 6}) {
+            if (expected.exists(key, v)) {
+                EXPECT_EQ(expected.children(key, v), versions.children(key, v));
+            }
+        }
+    }
+
+    versions.remove_subtree(1);
+    for (int key = 1; key <= 9; key++) {
+        EXPECT_FALSE(versions.exists(key));
+    }
+}
+
+TEST_F(DeltaNITest, ConcurrentReaders) {
+    int const num_commits = 2000;
+    std::atomic<bool> done(false);
+    std::atomic<size_t> errors(0);
+
+    // version 4 + i adds key 100 + i below key 100 + i - 2, 3 and 4 are
+    // the roots of two chains
+    auto reader = [this, &done, &errors]() {
+        size_t checked = 0;
+        while (!done || checked == 0) {
+            size_t version = versions.max_version();
+            int num_keys = static_cast<int>(version - 4);
+            for (int i = 0; i < num_keys; i += 1 + num_keys / 16) {
+                int key = 100 + i;
+                int root = i % 2 == 0 ? 3 : 4;
+                if (!versions.exists(key, version) || !versions.is_ancestor(root, key, version)) {
+                    errors++;
+                }
+                if (versions.num_childs(key, version) != (i + 2 < num_keys ? 1 : 0)) {
+                    errors++;
+                }
+            }
+            if (versions.exists(100 + num_keys, version)) {
+                errors++;
+            }
+            checked++;
+        }
+    };
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back(reader);
+    }
+    for (int i = 0; i < num_commits; i++) {
+        int parent = i < 2 ? 3 + i : 100 + i - 2;
+        versions.insert(parent, 100 + i, 100 + i);
+        versions.commit();
+    }
+    done = true;
+    for (std::thread& t : readers) {
+        t.join();
+    }
+    EXPECT_EQ(0, errors);
+    EXPECT_EQ(4 + num_commits, versions.max_version());
+}
+
+TEST_F(DeltaNISanityTest, RecoverLog) {
+    std::string path = ::testing::TempDir() + "deltani_recover.log";
+    std::remove(path.c_str());
+    TestingDeltaNI fresh = versions;
+    TestingDeltaNI torn = versions;
+    TestingDeltaNI appended = versions;
+    {
+        DeltaLog log(path);
+        versions.set_log(&log);
+        versions.insert(3, 7, 7);
+        versions.commit();
+        versions.update({
+            {false, 7, 8, 8},
+            {true, 2, 2, 0},
+        });
+        versions.commit();
+        versions.checkpoint(1);
+        versions.move_subtree(7, 4);
+        versions.commit();
+        versions.remove_subtree(4);
+        versions.insert(1, 4, 4);
+        versions.commit();
+        versions.set_log(nullptr);
+    }
+
+    EXPECT_EQ(4, fresh.recover(path));
+    expect_same_versions(versions, fresh);
+    EXPECT_EQ(8, fresh.search(8));
+    EXPECT_THROW(fresh.recover(path), deltani_invalid_version);
+
+    // a torn last record is cut off
+    std::FILE* file = std::fopen(path.c_str(), "r+b");
+    ASSERT_NE(nullptr, file);
+    std::fseek(file, -3, SEEK_END);
+    int byte = std::fgetc(file);
+    std::fseek(file, -3, SEEK_END);
+    std::fputc(byte ^ 0xff, file);
+    std::fclose(file);
+    EXPECT_EQ(3, torn.recover(path));
+    EXPECT_TRUE(torn.exists(4, 3));
+    {
+        DeltaLog log(path);
+        torn.set_log(&log);
+        torn.remove_subtree(4);
+        torn.insert(1, 4, 4);
+        torn.commit();
+        torn.set_log(nullptr);
+    }
+    EXPECT_EQ(4, appended.recover(path));
+    expect_same_versions(versions, appended);
+    std::remove(path.c_str());
+}
+
+/*
+ * Parent of every key of version, the root maps to itself.
+ */
+std::map<int, int> parents_of(TestingDeltaNI const& versions, size_t const version) {
+    std::map<int, int> parents = {{1, 1}};
+    std::vector<int> todo = {1};
+    while (!todo.empty()) {
+        int key = todo.back();
+        todo.pop_back();
+        for (int child : versions.children(key, version)) {
+            parents[child] = key;
+            todo.push_back(child);
+        }
+    }
+    return parents;
+}
+
+// compares diff with the parents of keys 1 to 12 for every pair of versions
+void expect_diffs(TestingDeltaNI const& versions) {
+    for (size_t v1 = 0; v1 <= versions.max_version(); v1++) {
+        std::map<int, int> parents1 = parents_of(versions, v1);
+        for (size_t v2 = v1; v2 <= versions.max_version(); v2++) {
+            std::map<int, int> parents2 = parents_of(versions, v2);
+            std::vector<std::pair<int, TestingDeltaNI::ChangeType>> expected;
+            for (int key = 1; key <= 12; key++) {
+                bool in1 = parents1.count(key) != 0;
+                bool in2 = parents2.count(key) != 0;
+                if (!in1 && in2) {
+                    expected.push_back({key, TestingDeltaNI::KEY_INSERTED});
+                } else if (in1 && !in2) {
+                    expected.push_back({key, TestingDeltaNI::KEY_REMOVED});
+                } else if (in1 && in2 && parents1[key] != parents2[key]) {
+                    expected.push_back({key, TestingDeltaNI::KEY_MOVED});
+                }
+            }
+            std::vector<std::pair<int, TestingDeltaNI::ChangeType>> actual;
+            for (TestingDeltaNI::Change const& change : versions.diff(v1, v2)) {
+                actual.push_back({change.key, change.type});
+            }
+            EXPECT_EQ(expected, actual) << "versions " << v1 << " to " << v2;
+        }
+    }
+}
+
+TEST_F(DeltaNITest, Diff) {
+    versions.insert(3, 7, 7);
+    versions.insert(7, 8, 8);
+    versions.commit();
+    versions.move_subtree(7, 6);
+    versions.commit();
+    versions.remove_subtree(4);
+    versions.commit();
+    versions.update({
+        {false, 1, 3, 3},
+        {false, 8, 9, 9},
+        {true, 5, 5, 0},
+    });
+    versions.commit();
+    versions.insert(9, 4, 4);
+    versions.move_subtree(8, 3);
+    versions.commit();
+    // a key with several children is removed with its subtree and inserted
+    // again, first under another parent and then under the same one
+    versions.insert(9, 10, 10);
+    for (int i = 0; i < 2; i++) {
+        versions.insert(10, 11, 11);
+        versions.insert(10, 12, 12);
+        versions.commit();
+        versions.remove_subtree(10);
+        versions.commit();
+        versions.insert(3, 10, 10);
+        versions.commit();
+    }
+
+    expect_diffs(versions);
+
+    EXPECT_THROW(versions.diff(2, 1), deltani_invalid_version);
+    EXPECT_THROW(versions.diff(0, versions.max_version() + 1), deltani_invalid_version);
+}
+
+TEST_F(DeltaNITest, DiffAcrossCheckpoint) {
+    versions.checkpoint(2);
+    versions.insert(3, 7, 7);
+    versions.insert(7, 8, 8);
+    versions.commit();
+    EXPECT_NO_THROW(versions.diff(1, 5));
+
+    versions.move_subtree(7, 6);
+    versions.commit();
+    versions.checkpoint(5);
+    versions.remove_subtree(4);
+    versions.commit();
+    versions.update({
+        {false, 1, 3, 3},
+        {false, 8, 9, 9},
+        {true, 5, 5, 0},
+    });
+    versions.commit();
+    versions.insert(9, 4, 4);
+    versions.move_subtree(8, 3);
+    versions.commit();
+    // a key with several children is removed with its subtree and inserted
+    // again, first under another parent and then under the same one
+    versions.insert(9, 10, 10);
+    for (int i = 0; i < 2; i++) {
+        versions.insert(10, 11, 11);
+        versions.insert(10, 12, 12);
+        versions.commit();
+        versions.remove_subtree(10);
+        versions.commit();
+        versions.insert(3, 10, 10);
+        versions.commit();
+    }
+
+    expect_diffs(versions);
+}
+
+TEST_F(DeltaNITest, VersionCache) {
+    typedef std::vector<size_t> Versions;
+    TestingDeltaNI expected = versions;
+
+    versions.set_version_cache(1 << 20);
+    for (size_t v = 0; v <= versions.max_version(); v++) {
+        EXPECT_EQ(expected.children(1, v), versions.children(1, v));
+    }
+    EXPECT_EQ(Versions(), versions.cached_versions());
+    for (size_t v = 0; v <= versions.max_version(); v++) {
+        EXPECT_EQ(expected.is_ancestor(4, 3, v), versions.is_ancestor(4, 3, v));
+    }
+    EXPECT_EQ(Versions({0, 1, 2, 3, 4}), versions.cached_versions());
+    expect_same_versions(expected, versions);
+
+    // keys inserted after a cached version are reported like before
+    versions.insert(3, 7, 7);
+    versions.commit();
+    EXPECT_FALSE(versions.exists(7, 2));
+    EXPECT_THROW(versions.children(7, 2), deltani_key_removed);
+    EXPECT_TRUE(versions.is_ancestor(3, 7, 5));
+
+    // room for two versions, the least recently used one goes
+    versions.set_version_cache(0);
+    EXPECT_EQ(0, versions.version_cache_bytes());
+    versions.set_version_cache(1 << 20, 1);
+    size_t smallest = 1 << 20;
+    for (size_t v = 1; v <= 3; v++) {
+        size_t before = versions.version_cache_bytes();
+        versions.cache_version(v);
+        smallest = std::min(smallest, versions.version_cache_bytes() - before);
+    }
+    size_t all = versions.version_cache_bytes();
+    versions.set_version_cache(0);
+    versions.set_version_cache(all - smallest, 1);
+    versions.exists(1, 2);
+    versions.exists(1, 1);
+    versions.exists(1, 3);
+    EXPECT_EQ(Versions({1, 3}), versions.cached_versions());
+
+    versions.checkpoint(4);
+    EXPECT_EQ(expected.children(1, 1), versions.children(1, 1));
+    EXPECT_EQ(expected.children(4, 3), versions.children(4, 3));
+    versions.cache_version(2);
+    EXPECT_EQ(Versions({2, 3}), versions.cached_versions());
+    EXPECT_EQ(expected.children(4, 2), versions.children(4, 2));
+    EXPECT_THROW(versions.cache_version(6), deltani_invalid_version);
+}
+
+TEST_F(DeltaNITest, TruncateBefore) {
+    TestingDeltaNI expected = versions;
+    for (TestingDeltaNI* v : {&expected, &versions}) {
+        v->insert(3, 7, 7);
+        v->commit();
+        v->move_subtree(7, 6);
+        v->commit();
+    }
+    versions.checkpoint(2);
+    versions.set_version_cache(1 << 20, 1);
+    versions.cache_version(1);
+    versions.cache_version(5);
+
+    versions.truncate_before(3);
+    EXPECT_EQ(3, versions.checkpoint_version());
+    EXPECT_EQ(6, versions.max_version());
+    EXPECT_EQ(std::vector<size_t>({5}), versions.cached_versions());
+    for (size_t v = 3; v <= 6; v++) {
+        for (int a = 1; a <= 7; a++) {
+            ASSERT_EQ(expected.exists(a, v), versions.exists(a, v));
+            if (!expected.exists(a, v)) {
+                continue;
+            }
+            EXPECT_EQ(expected.children(a, v), versions.children(a, v));
+            for (int b = 1; b <= 7; b++) {
+                if (expected.exists(b, v)) {
+                    EXPECT_EQ(expected.lca(a, b, v), versions.lca(a, b, v));
+                }
+            }
+        }
+    }
+    EXPECT_EQ(expected.diff(3, 6).size(), versions.diff(3, 6).size());
+    for (size_t v = 0; v < 3; v++) {
+        EXPECT_THROW(versions.exists(1, v), deltani_invalid_version);
+        EXPECT_THROW(versions.children(1, v), deltani_invalid_version);
+        EXPECT_THROW(versions.lca(1, 3, v), deltani_invalid_version);
+        EXPECT_THROW(versions.diff(v, 6), deltani_invalid_version);
+        EXPECT_THROW(versions.cache_version(v), deltani_invalid_version);
+    }
+    EXPECT_THROW(versions.truncate_before(2), deltani_invalid_version);
+
+    // versions keep counting from where they were
+    versions.insert(7, 8, 8);
+    EXPECT_EQ(7, versions.commit());
+    versions.truncate_before(7);
+    EXPECT_EQ(std::vector<int>({8}), versions.children(7, 7));
+    EXPECT_THROW(versions.exists(1, 6), deltani_invalid_version);
+}
+
+TEST_F(DeltaNITest, MemoryUsage) {
+    std::vector<size_t> levels = versions.memory_usage();
+    ASSERT_EQ(3, levels.size());
+    for (size_t bytes : levels) {
+        EXPECT_LT(0, bytes);
+    }
+
+    versions.insert(3, 7, 7);
+    versions.commit();
+    EXPECT_EQ(3, versions.memory_usage().size());
+    EXPECT_LT(levels[0], versions.memory_usage()[0]);
+
+    versions.truncate_before(5);
+    EXPECT_EQ(std::vector<size_t>(), versions.memory_usage());
+}
+
+TEST_F(DeltaNITest, BackgroundMerges) {
+    int const num_commits = 300;
+    TestingDeltaNI expected = versions;
+    std::atomic<bool> done(false);
+    std::atomic<size_t> errors(0);
+
+    // same chains as in ConcurrentReaders
+    auto commit_chain = [](TestingDeltaNI& v, int const from, int const to) {
+        for (int i = from; i < to; i++) {
+            int parent = i < 2 ? 3 + i : 100 + i - 2;
+            v.insert(parent, 100 + i, 100 + i);
+            v.commit();
+        }
+    };
+
+    versions.set_background_merges(true);
+    std::thread reader([this, &done, &errors]() {
+        while (!done) {
+            size_t version = versions.max_version();
+            int last = static_cast<int>(version) - 5;
+            if (last >= 0 && !versions.is_ancestor(last % 2 == 0 ? 3 : 4, 100 + last, version)) {
+                errors++;
+            }
+        }
+    });
+    commit_chain(versions, 0, num_commits);
+    done = true;
+    reader.join();
+    EXPECT_EQ(0, errors);
+
+    commit_chain(expected, 0, num_commits);
+    auto expect_same_chains = [&expected, this]() {
+        ASSERT_EQ(expected.max_version(), versions.max_version());
+        for (size_t v = 0; v <= versions.max_version(); v += 7) {
+            for (int key = 100; key < 100 + num_commits; key += 13) {
+                ASSERT_EQ(expected.exists(key, v), versions.exists(key, v)) << "version " << v << " key " << key;
+                if (!expected.exists(key, v)) {
+                    continue;
+                }
+                EXPECT_EQ(expected.is_ancestor(3, key, v), versions.is_ancestor(3, key, v));
+                EXPECT_EQ(expected.num_childs(key, v), versions.num_childs(key, v));
+            }
+        }
+    };
+    expect_same_chains();
+    versions.wait_for_merges();
+    EXPECT_EQ(expected.memory_usage(), versions.memory_usage());
+    expect_same_chains();
+
+    // the pyramid is rebuilt with the merger running
+    expected.checkpoint(100);
+    versions.checkpoint(100);
+    commit_chain(expected, num_commits, num_commits + 10);
+    commit_chain(versions, num_commits, num_commits + 10);
+    versions.set_background_merges(false);
+    commit_chain(expected, num_commits + 10, num_commits + 20);
+    commit_chain(versions, num_commits + 10, num_commits + 20);
+    EXPECT_EQ(expected.memory_usage(), versions.memory_usage());
+    expect_same_chains();
+}
+
+TEST_F(DeltaNITest, Compact) {
+    TestingDeltaNI expected = versions;
+    for (TestingDeltaNI* v : {&expected, &versions}) {
+        v->insert(3, 7, 7);
+        v->commit();
+        v->remove(7);
+        v->insert(3, 8, 8);
+        v->commit();
+    }
+    EXPECT_EQ(16, versions.interval_space());
+
+    versions.insert(1, 9, 9);
+    EXPECT_THROW(versions.compact(), deltani_compact_error);
+    versions.remove(9);
+    versions.commit();
+    expected.insert(1, 9, 9);
+    expected.remove(9);
+    expected.commit();
+
+    // the live edges of the latest version are 1, 2, 3, 4, 6 and 8
+    versions.compact();
+    EXPECT_EQ(7, versions.checkpoint_version());
+    EXPECT_EQ(12, versions.interval_space());
+    expect_same_versions(expected, versions);
+    EXPECT_FALSE(versions.exists(7));
+    EXPECT_THROW(versions.is_ancestor(3, 7), deltani_invalid_key);
+    EXPECT_TRUE(versions.exists(7, 5));
+
+    for (TestingDeltaNI* v : {&expected, &versions}) {
+        v->insert(8, 7, 7);
+        v->commit();
+        v->move_subtree(3, 1);
+        v->commit();
+    }
+    EXPECT_EQ(14, versions.interval_space());
+    expect_same_versions(expected, versions);
+
+    versions.truncate_before(versions.max_version());
+    versions.compact();
+    EXPECT_EQ(14, versions.interval_space());
+    EXPECT_EQ(expected.children(1), versions.children(1));
+    EXPECT_EQ(expected.children(3), versions.children(3));
+}
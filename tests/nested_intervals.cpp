@@ -0,0 +1,332 @@
+#include <cstdint>
+#include <vector>
+#include <gtest/gtest.h>
+#include "adj_list.h"
+#include "nested_intervals.h"
+#include "ni_convert.h"
+
+typedef NestedIntervals<int, int> TestingNI;
+typedef TestingNI::NIEdgeTree NIEdgeTree;
+typedef TestingNI::NIEdgeColumns NIEdgeColumns;
+typedef TestingNI::ValueTree ValueTree;
+typedef AdjacencyList<int, int>::AdjacencyTree AdjacencyTree;
+
+class NestedIntervalsTest
+: public ::testing::Test {
+public:
+    NIEdgeTree edges;
+    TestingNI ni;
+
+    virtual void SetUp() {
+        edges.insert(5, {5, 3, 4});
+        edges.insert(2, {2, 2, 5});
+        edges.insert(6, {6, 7, 8});
+        edges.insert(3, {3, 6, 9});
+        edges.insert(7, {7, 11, 12});
+        edges.insert(4, {4, 10, 13});
+        edges.insert(1, {1, 1, 14});
+        ValueTree values;
+        for (int i=1; i<=7; i++) {
+            values.insert(i, i);
+        }
+        ni = TestingNI(values, edges);
+    }
+};
+
+TEST_F(NestedIntervalsTest, Columns) {
+    NIEdgeColumns columns(edges);
+    ASSERT_EQ(7, columns.size());
+
+    uint64_t last = 0;
+    for (size_t i = 0; i < columns.size(); i++) {
+        EXPECT_LT(last, columns.lower(i));
+        last = columns.lower(i);
+    }
+
+    size_t pos;
+    ASSERT_TRUE(columns.find(3, pos));
+    EXPECT_EQ(3, columns.key(pos));
+    EXPECT_EQ(6, columns.lower(pos));
+    EXPECT_EQ(9, columns.upper(pos));
+    EXPECT_EQ(1, columns.num_descendants(pos));
+    EXPECT_EQ(1, columns.depth(pos));
+    EXPECT_FALSE(columns.find(8, pos));
+
+    ASSERT_TRUE(columns.find(1, pos));
+    EXPECT_EQ(6, columns.num_descendants(pos));
+    EXPECT_EQ(0, columns.depth(pos));
+    EXPECT_EQ(13, columns.last_bound(pos));
+
+    ASSERT_TRUE(columns.find(5, pos));
+    EXPECT_EQ(3, columns.last_bound(pos));
+    std::vector<size_t> ancestors;
+    columns.ancestors(pos, ancestors);
+    ASSERT_EQ(2, ancestors.size());
+    EXPECT_EQ(1, columns.key(ancestors[0]));
+    EXPECT_EQ(2, columns.key(ancestors[1]));
+}
+
+TEST_F(NestedIntervalsTest, Exists) {
+    for (int i=1; i<=7; i++) {
+        EXPECT_TRUE(ni.exists(i, 0));
+    }
+    EXPECT_FALSE(ni.exists(0, 0));
+    EXPECT_FALSE(ni.exists(8, 0));
+}
+
+TEST_F(NestedIntervalsTest, Children) {
+    EXPECT_EQ(std::vector<int>({2, 3, 4}), ni.children(1, 0));
+    EXPECT_EQ(std::vector<int>({5}), ni.children(2, 0));
+    EXPECT_EQ(std::vector<int>({6}), ni.children(3, 0));
+    EXPECT_EQ(std::vector<int>({7}), ni.children(4, 0));
+    EXPECT_TRUE(ni.children(5, 0).empty());
+
+    EXPECT_EQ(3, ni.num_childs(1, 0));
+    EXPECT_EQ(1, ni.num_childs(2, 0));
+    EXPECT_EQ(0, ni.num_childs(7, 0));
+
+    EXPECT_THROW(ni.children(8, 0), hierarchy_key_not_found);
+    EXPECT_THROW(ni.num_childs(8, 0), hierarchy_key_not_found);
+}
+
+TEST_F(NestedIntervalsTest, ChildrenBuffer) {
+    std::vector<int> buffer;
+    ni.children(1, 0, buffer);
+    EXPECT_EQ(std::vector<int>({2, 3, 4}), buffer);
+    ni.children(5, buffer);
+    EXPECT_TRUE(buffer.empty());
+
+    for (int child : ni.child_range(1)) {
+        buffer.push_back(child);
+    }
+    EXPECT_EQ(std::vector<int>({2, 3, 4}), buffer);
+    EXPECT_TRUE(ni.child_range(7).begin() == ni.child_range(7).end());
+    EXPECT_THROW(ni.child_range(8), hierarchy_key_not_found);
+}
+
+TEST_F(NestedIntervalsTest, IsAncestor) {
+    EXPECT_TRUE(ni.is_ancestor(1, 2, 0));
+    EXPECT_TRUE(ni.is_ancestor(1, 5, 0));
+    EXPECT_TRUE(ni.is_ancestor(2, 5, 0));
+    EXPECT_TRUE(ni.is_ancestor(4, 7, 0));
+
+    EXPECT_FALSE(ni.is_ancestor(1, 1, 0));
+    EXPECT_FALSE(ni.is_ancestor(2, 1, 0));
+    EXPECT_FALSE(ni.is_ancestor(2, 6, 0));
+    EXPECT_FALSE(ni.is_ancestor(3, 7, 0));
+
+    EXPECT_THROW(ni.is_ancestor(1, 8, 0), hierarchy_key_not_found);
+}
+
+TEST(NIColumnsTest, Chain) {
+    int const length = 100;
+    NIEdgeTree chain;
+    for (int i = 1; i <= length; i++) {
+        chain.insert(i, {i, NIBound(i), NIBound(2 * length + 1 - i)});
+    }
+    NIEdgeColumns columns(chain);
+
+    for (int i = 1; i <= length; i++) {
+        size_t pos;
+        ASSERT_TRUE(columns.find(i, pos));
+        EXPECT_EQ(i - 1, columns.depth(pos));
+        EXPECT_EQ(length - i, columns.num_descendants(pos));
+        EXPECT_EQ(i < length ? 1 : 0, columns.num_children(pos));
+
+        std::vector<size_t> ancestors;
+        columns.ancestors(pos, ancestors);
+        ASSERT_EQ(i - 1, ancestors.size());
+        for (int j = 0; j < i - 1; j++) {
+            EXPECT_EQ(j + 1, columns.key(ancestors[j]));
+        }
+    }
+}
+
+TEST(NIColumnsTest, Forest) {
+    // roots 1 and 4, 2 and 3 are children of 1, 5 is a child of 4
+    NIEdgeTree forest;
+    forest.insert(1, {1, 1, 6});
+    forest.insert(2, {2, 2, 3});
+    forest.insert(3, {3, 4, 5});
+    forest.insert(4, {4, 7, 10});
+    forest.insert(5, {5, 8, 9});
+    NIEdgeColumns columns(forest);
+
+    size_t pos;
+    ASSERT_TRUE(columns.find(3, pos));
+    EXPECT_EQ(1, columns.depth(pos));
+    ASSERT_TRUE(columns.find(4, pos));
+    EXPECT_EQ(0, columns.depth(pos));
+    ASSERT_TRUE(columns.find(5, pos));
+    EXPECT_EQ(1, columns.depth(pos));
+    std::vector<size_t> ancestors;
+    columns.ancestors(pos, ancestors);
+    ASSERT_EQ(1, ancestors.size());
+    EXPECT_EQ(4, columns.key(ancestors[0]));
+}
+
+TEST_F(NestedIntervalsTest, Insert) {
+    EXPECT_THROW(ni.insert(8, 9, 9), hierarchy_key_not_found);
+    EXPECT_THROW(ni.insert(1, 2, 2), ni_key_exists);
+
+    ni.insert(5, 8, 8);
+    ni.insert(1, 9, 9);
+
+    EXPECT_TRUE(ni.exists(8, 0));
+    EXPECT_TRUE(ni.exists(9, 0));
+    EXPECT_EQ(8, ni.search(8));
+    EXPECT_EQ(std::vector<int>({8}), ni.children(5, 0));
+    EXPECT_EQ(std::vector<int>({2, 3, 4, 9}), ni.children(1, 0));
+    EXPECT_TRUE(ni.is_ancestor(2, 8, 0));
+    EXPECT_TRUE(ni.is_ancestor(1, 8, 0));
+    EXPECT_FALSE(ni.is_ancestor(3, 8, 0));
+    EXPECT_FALSE(ni.is_ancestor(9, 8, 0));
+}
+
+TEST_F(NestedIntervalsTest, Remove) {
+    EXPECT_THROW(ni.remove(8), hierarchy_key_not_found);
+    EXPECT_THROW(ni.remove(2), ni_key_has_children);
+
+    ni.remove(5);
+    ni.remove(2);
+
+    EXPECT_FALSE(ni.exists(5, 0));
+    EXPECT_FALSE(ni.exists(2, 0));
+    EXPECT_THROW(ni.search(5), hierarchy_key_not_found);
+    EXPECT_THROW(ni.search(2), hierarchy_key_not_found);
+    EXPECT_EQ(3, ni.search(3));
+    EXPECT_EQ(std::vector<int>({3, 4}), ni.children(1, 0));
+    EXPECT_TRUE(ni.is_ancestor(1, 7, 0));
+
+    ni.insert(4, 2, 20);
+    EXPECT_EQ(std::vector<int>({7, 2}), ni.children(4, 0));
+    EXPECT_EQ(20, ni.search(2));
+}
+
+TEST_F(NestedIntervalsTest, InsertWithoutRelabel) {
+    // a loaded leaf has a whole gap of free space
+    int const num = 10;
+    for (int i = 0; i < num; i++) {
+        ni.insert(5, 100 + i, i);
+    }
+    ni.insert(100, 200, 200);
+    ni.insert(200, 201, 201);
+    EXPECT_EQ(0, ni.relabels());
+    EXPECT_EQ(num, ni.num_childs(5, 0));
+    EXPECT_TRUE(ni.is_ancestor(2, 201, 0));
+    EXPECT_FALSE(ni.is_ancestor(101, 201, 0));
+}
+
+TEST_F(NestedIntervalsTest, ExhaustGaps) {
+    EXPECT_THROW(TestingNI(ValueTree(), edges, 2), ni_gap_too_small);
+    EXPECT_THROW(TestingNI(ValueTree(), NIEdgeColumns(edges), 0), ni_gap_too_small);
+    TestingNI dense(ValueTree(), edges, 4);
+
+    // a deep chain below 7 and many siblings below 6
+    int const num = 500;
+    for (int i = 0; i < num; i++) {
+        dense.insert(i == 0 ? 7 : 1000 + i - 1, 1000 + i, i);
+        dense.insert(6, 2000 + i, i);
+    }
+
+    EXPECT_EQ(1, dense.num_childs(7, 0));
+    EXPECT_EQ(num, dense.num_childs(6, 0));
+    std::vector<int> siblings = dense.children(6, 0);
+    for (int i = 0; i < num; i++) {
+        EXPECT_EQ(2000 + i, siblings[i]);
+        EXPECT_TRUE(dense.is_ancestor(3, 2000 + i, 0));
+        EXPECT_TRUE(dense.is_ancestor(7, 1000 + i, 0));
+        EXPECT_FALSE(dense.is_ancestor(1000 + i, 2000 + i, 0));
+    }
+    EXPECT_EQ(std::vector<int>({1000 + num - 1}), dense.children(1000 + num - 2, 0));
+    EXPECT_EQ(std::vector<int>({2, 3, 4}), dense.children(1, 0));
+    EXPECT_LT(0, dense.relabels());
+}
+
+TEST_F(NestedIntervalsTest, AppendManyChildren) {
+    // the last bound of a parent is kept, so appends don't scan its children
+    int const num = 20000;
+    for (int i = 0; i < num; i++) {
+        ni.insert(5, 100 + i, i);
+    }
+    ni.remove(100 + num - 1);
+    ni.insert(5, 100 + num - 1, num - 1);
+    ni.insert(100 + num - 1, 99, 99);
+
+    EXPECT_EQ(num, ni.num_childs(5, 0));
+    std::vector<int> children = ni.children(5, 0);
+    for (int i = 0; i < num; i++) {
+        EXPECT_EQ(100 + i, children[i]);
+    }
+    EXPECT_TRUE(ni.is_ancestor(5, 99, 0));
+    EXPECT_FALSE(ni.is_ancestor(100 + num - 2, 99, 0));
+    EXPECT_EQ(std::vector<int>({6}), ni.children(3, 0));
+}
+
+TEST_F(NestedIntervalsTest, Lca) {
+    EXPECT_EQ(1, ni.lca(5, 6, 0));
+    EXPECT_EQ(1, ni.lca(2, 7, 0));
+    EXPECT_EQ(2, ni.lca(2, 5, 0));
+    EXPECT_EQ(2, ni.lca(5, 2, 0));
+    EXPECT_EQ(1, ni.lca(7, 1, 0));
+    EXPECT_EQ(6, ni.lca(6, 6, 0));
+    EXPECT_THROW(ni.lca(8, 1, 0), hierarchy_key_not_found);
+
+    ni.insert(5, 8, 8);
+    ni.insert(5, 9, 9);
+    EXPECT_EQ(5, ni.lca(8, 9, 0));
+    EXPECT_EQ(2, ni.lca(8, 2, 0));
+    EXPECT_EQ(1, ni.lca(8, 7, 0));
+}
+
+TEST_F(NestedIntervalsTest, Convert) {
+    AdjacencyTree adj_edges;
+    adj_edges.insert(1, {1, 2});
+    adj_edges.insert(1, {1, 3});
+    adj_edges.insert(1, {1, 4});
+    adj_edges.insert(2, {2, 5});
+    adj_edges.insert(3, {3, 6});
+    adj_edges.insert(4, {4, 7});
+
+    for (size_t threads : {1, 4}) {
+        NIEdgeTree converted;
+        NIConverter<int> converter(adj_edges, threads);
+        EXPECT_EQ(7, converter.convert(converted));
+        for (int i = 1; i <= 7; i++) {
+            TestingNI::NIEdge expected, edge;
+            ASSERT_TRUE(edges.search(i, expected));
+            ASSERT_TRUE(converted.search(i, edge));
+            EXPECT_EQ(expected.lower, edge.lower);
+            EXPECT_EQ(expected.upper, edge.upper);
+        }
+    }
+}
+
+TEST(NIConverterTest, Forest) {
+    // a deep chain, a wide root and a small tree next to each other
+    int const num = 10000;
+    AdjacencyTree adj_edges;
+    for (int i = 1; i < num; i++) {
+        adj_edges.insert(i - 1, {i - 1, i});
+        adj_edges.insert(num, {num, num + i});
+    }
+    adj_edges.insert(2 * num, {2 * num, 2 * num + 1});
+
+    NIEdgeTree serial, parallel;
+    EXPECT_EQ(2 * num + 2, NIConverter<int>(adj_edges, 1).convert(serial));
+    EXPECT_EQ(2 * num + 2, NIConverter<int>(adj_edges, 8).convert(parallel));
+    auto it = parallel.begin();
+    for (TestingNI::NIEdge& edge : serial) {
+        ASSERT_EQ(edge.key, (*it).key);
+        EXPECT_EQ(edge.lower, (*it).lower);
+        EXPECT_EQ(edge.upper, (*it).upper);
+        ++it;
+    }
+
+    TestingNI ni(ValueTree(), parallel);
+    EXPECT_TRUE(ni.is_ancestor(0, num - 1, 0));
+    EXPECT_TRUE(ni.is_ancestor(num, 2 * num - 1, 0));
+    EXPECT_FALSE(ni.is_ancestor(0, num + 1, 0));
+    EXPECT_EQ(num - 1, ni.num_childs(num, 0));
+    EXPECT_EQ(std::vector<int>({2 * num + 1}), ni.children(2 * num, 0));
+}
@@ -0,0 +1,34 @@
+#include <atomic>
+#include <vector>
+#include <gtest/gtest.h>
+#include "thread_pool.h"
+
+TEST(ThreadPoolTest, ParallelFor) {
+    ThreadPool pool(4);
+    EXPECT_EQ(4, pool.size());
+    for (size_t num : {0, 1, 3, 1000}) {
+        std::vector<std::atomic<int>> calls(num);
+        std::atomic<bool> valid_worker(true);
+        pool.parallel_for(num, [&](size_t i, size_t worker) {
+            calls[i]++;
+            if (worker >= 4) {
+                valid_worker = false;
+            }
+        });
+        for (size_t i = 0; i < num; i++) {
+            EXPECT_EQ(1, calls[i]);
+        }
+        EXPECT_TRUE(valid_worker);
+    }
+}
+
+TEST(ThreadPoolTest, SingleThread) {
+    ThreadPool pool(1);
+    EXPECT_EQ(1, pool.size());
+    size_t sum = 0;
+    pool.parallel_for(100, [&sum](size_t i, size_t worker) {
+        EXPECT_EQ(0, worker);
+        sum += i;
+    });
+    EXPECT_EQ(4950, sum);
+}